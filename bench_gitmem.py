@@ -0,0 +1,82 @@
+import os
+import re
+import subprocess
+import sys
+import time
+import argparse
+
+BENCH_DIR = os.path.join("examples", "oracle")
+STATS_PATTERN = re.compile(r"Explored (\d+) state\(s\)")
+
+def time_run(gitmem_path, file_path, extra_args, repeat):
+    best = None
+    output = ""
+    returncode = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        try:
+            result = subprocess.run([gitmem_path, file_path, "-e", "-o", "/dev/null"] + extra_args,
+                                    capture_output=True, text=True)
+        except FileNotFoundError:
+            print(f"Error: '{gitmem_path}' executable not found.")
+            sys.exit(1)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+        output = result.stdout
+        returncode = result.returncode
+    return best, output, returncode
+
+def main():
+    parser = argparse.ArgumentParser(description="Exploration benchmark for gitmem.")
+    parser.add_argument(
+        "--gitmem", "-g",
+        required=True,
+        help="Path to the gitmem executable"
+    )
+    parser.add_argument(
+        "--baseline", "-b",
+        help="Path to a gitmem executable to compare against"
+    )
+    parser.add_argument(
+        "--repeat", "-r",
+        type=int,
+        default=5,
+        help="Number of runs per program, the fastest run is reported"
+    )
+    parser.add_argument(
+        "--dir", "-d",
+        default=BENCH_DIR,
+        help="Directory of programs to explore"
+    )
+    args = parser.parse_args()
+
+    # States are counted by the benchmarked executable; the baseline explores
+    # the same state space, so its rate is derived from the same count. A
+    # baseline that does not agree on the result explored something else,
+    # and its rate is not reported.
+    header = f"{'program':<45} {'states':>8} {'time (s)':>10} {'states/s':>12}"
+    if args.baseline:
+        header += f" {'base (s)':>10} {'base states/s':>14} {'speedup':>8}"
+    print(header)
+
+    for file in sorted(os.listdir(args.dir)):
+        if not file.endswith(".gm"):
+            continue
+        file_path = os.path.join(args.dir, file)
+        elapsed, output, returncode = time_run(args.gitmem, file_path, ["--stats"], args.repeat)
+        match = STATS_PATTERN.search(output)
+        if not match:
+            print(f"{file:<45} no statistics reported")
+            continue
+        states = int(match.group(1))
+        line = f"{file:<45} {states:>8} {elapsed:>10.4f} {states / elapsed:>12.0f}"
+        if args.baseline:
+            base_elapsed, _, base_returncode = time_run(args.baseline, file_path, [], args.repeat)
+            if base_returncode != returncode:
+                line += f" baseline exited with {base_returncode}, not {returncode}"
+            else:
+                line += f" {base_elapsed:>10.4f} {states / base_elapsed:>14.0f} {base_elapsed / elapsed:>7.2f}x"
+        print(line)
+
+if __name__ == "__main__":
+    main()
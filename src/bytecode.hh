@@ -0,0 +1,119 @@
+#pragma once
+
+#include <trieste/trieste.h>
+#include "lang.hh"
+
+namespace gitmem
+{
+    using namespace trieste;
+
+    /* Global variables are interned as small integers when a program is
+     * compiled, and are identified by them everywhere at run time */
+    using VarID = size_t;
+
+    namespace bytecode
+    {
+        /* The interpreter does not run the AST of the branching pass directly
+         * but a flat compiled form of it. Every block is compiled to a Code
+         * with exactly one instruction per statement, so the program counter
+         * of a thread indexes both its block and its code. Expressions are
+         * compiled to postfix operations that run on a value stack, with
+         * constants parsed, global variables interned and registers
+         * allocated to slots at compile time. Every block that a thread
+         * starts in has its own register slots, shared by the flattened
+         * branches of its conditionals but not by the blocks it spawns.
+         */
+
+        struct Code;
+
+        enum class ExprOp : uint8_t
+        {
+            Const, // push `value`
+            Reg,   // push the register in `slot`
+            Var,   // push the global `var`
+            Spawn, // spawn a thread running `block`/`code` and push its id
+            Add,   // pop `value` operands and push their sum
+            Eq,    // pop two operands and push whether they are equal
+            Neq,   // pop two operands and push whether they differ
+        };
+
+        struct ExprInstr
+        {
+            ExprOp op;
+            size_t value = 0;
+            VarID var = 0;
+            size_t slot = 0;
+            Node block = {};
+            const Code *code = nullptr;
+        };
+
+        enum class Op : uint8_t
+        {
+            Nop,
+            Jump,      // move the pc by `delta`
+            Cond,      // move the pc by 1 if the expression holds, by `delta` otherwise
+            AssignReg, // assign the expression to the register in `slot`
+            AssignVar, // assign the expression to the global `var`
+            Join,      // join the thread the expression evaluates to
+            Lock,      // lock `name`
+            Unlock,    // unlock `name`
+            Assert,    // fail unless the expression holds
+        };
+
+        struct Instr
+        {
+            Op op;
+            int delta = 0;
+            std::string name;
+            VarID var = 0;
+            size_t slot = 0;
+
+            // The range of the instruction's expression in Code::exprs
+            uint32_t expr_begin = 0;
+            uint32_t expr_end = 0;
+
+            // The expression node, which keys the join cache and describes
+            // failed assertions
+            Node expr;
+
+            // Whether a step of the model checker that starts at this
+            // instruction may spawn a thread before its next sync point
+            bool step_spawns = false;
+
+            bool is_syncing() const { return op == Op::Join || op == Op::Lock || op == Op::Unlock; }
+        };
+
+        struct Code
+        {
+            std::vector<Instr> instrs;
+            std::vector<ExprInstr> exprs;
+            size_t max_stack = 0; // The deepest value stack of any expression
+
+            std::vector<std::string> regs; // The name of each register slot
+            std::unordered_map<std::string, size_t> reg_slots;
+        };
+
+        /* The compiled blocks of a program, which stay at a fixed address for
+         * as long as the program is alive, and the symbol table of its global
+         * variables.
+         */
+        struct Program
+        {
+            Node ast; // The program that was compiled, which the blocks are keyed by
+            NodeMap<std::unique_ptr<Code>> blocks;
+            std::vector<std::string> vars; // The name of each global variable
+            std::unordered_map<std::string, VarID> var_ids;
+
+            const Code &code(const Node &block) const { return *blocks.at(block); }
+            Node entry() const { return ast / File / Block; }
+        };
+
+        using ProgramPtr = std::shared_ptr<const Program>;
+
+        /* Compile the blocks of a program that has been through the
+         * branching pass. The entry points compile a program once and hand
+         * it to every context that runs it.
+         */
+        ProgramPtr compile(const Node &ast);
+    }
+}
@@ -0,0 +1,342 @@
+#include <fstream>
+
+#include "model_checker.hh"
+
+namespace gitmem
+{
+    using namespace trieste;
+
+    /**
+     * A checkpoint starts with a magic number and a format version, followed
+     * by a hash of the program and the options that shape the scheduling
+     * tree, the statistics and final traces found so far, and the path from
+     * the root to the cursor. Numbers are stored as LEB128 varints, so thread
+     * IDs and trace lengths mostly take a single byte.
+     *
+     * The global contexts along the path are not stored, they are rebuilt by
+     * replaying the trace when the checkpoint is loaded.
+     */
+    constexpr char checkpoint_magic[] = {'G', 'M', 'C', 'K'};
+    constexpr size_t checkpoint_version = 3;
+
+    class CheckpointWriter
+    {
+        std::string bytes;
+
+    public:
+        void add(size_t value)
+        {
+            do
+            {
+                char byte = value & 0x7f;
+                value >>= 7;
+                if (value)
+                    byte |= char(0x80);
+                bytes += byte;
+            } while (value);
+        }
+
+        void add(const std::optional<size_t> &value) { add(value ? *value + 1 : 0); }
+
+        void add(const std::string &str)
+        {
+            add(str.size());
+            bytes.append(str);
+        }
+
+        template <typename C>
+        void add_all(const C &values)
+        {
+            add(values.size());
+            for (const auto &value : values)
+                add(value);
+        }
+
+        void add(const SyncEvent &event)
+        {
+            add(event.tid);
+            add(size_t(event.kind));
+            add(event.lock);
+            add(event.joinee);
+            add(size_t(event.spawns));
+        }
+
+        void add_events(const std::vector<SyncEvent> &events)
+        {
+            add(events.size());
+            for (const auto &event : events)
+                add(event);
+        }
+
+        std::string_view view() const { return bytes; }
+
+        void write(const std::filesystem::path &file) const
+        {
+            // Write to a temporary file first, so that a crash while writing
+            // leaves the previous checkpoint intact
+            auto tmp = file;
+            tmp += ".tmp";
+            {
+                std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+                out.write(checkpoint_magic, sizeof(checkpoint_magic));
+                out.write(bytes.data(), bytes.size());
+                if (!out)
+                    throw std::runtime_error("Could not write checkpoint " + tmp.string());
+            }
+            std::filesystem::rename(tmp, file);
+        }
+    };
+
+    class CheckpointReader
+    {
+        std::string bytes;
+        size_t pos = 0;
+
+        [[noreturn]] void corrupt() const
+        {
+            throw std::runtime_error("Checkpoint is truncated or corrupt");
+        }
+
+    public:
+        CheckpointReader(const std::filesystem::path &file)
+        {
+            std::ifstream in(file, std::ios::binary);
+            if (!in)
+                throw std::runtime_error("Could not read checkpoint " + file.string());
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+            if (bytes.compare(0, sizeof(checkpoint_magic), checkpoint_magic, sizeof(checkpoint_magic)) != 0)
+                throw std::runtime_error(file.string() + " is not a checkpoint");
+            pos = sizeof(checkpoint_magic);
+        }
+
+        size_t number()
+        {
+            size_t value = 0;
+            for (size_t shift = 0; shift < 64; shift += 7)
+            {
+                if (pos >= bytes.size())
+                    corrupt();
+                auto byte = uint8_t(bytes[pos++]);
+                value |= size_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+            corrupt();
+        }
+
+        std::optional<size_t> optional()
+        {
+            auto value = number();
+            return value ? std::optional<size_t>(value - 1) : std::nullopt;
+        }
+
+        std::string string()
+        {
+            auto size = number();
+            if (size > bytes.size() - pos)
+                corrupt();
+            pos += size;
+            return bytes.substr(pos - size, size);
+        }
+
+        std::vector<size_t> numbers()
+        {
+            std::vector<size_t> values(number());
+            for (auto &value : values)
+                value = number();
+            return values;
+        }
+
+        SyncEvent event()
+        {
+            auto tid = number();
+            auto kind = number();
+            if (kind > size_t(SyncKind::join))
+                corrupt();
+            auto lock = string();
+            auto joinee = optional();
+            return {tid, SyncKind(kind), std::move(lock), joinee, number() != 0};
+        }
+
+        std::vector<SyncEvent> events()
+        {
+            std::vector<SyncEvent> events;
+            for (size_t i = number(); i > 0; --i)
+                events.push_back(event());
+            return events;
+        }
+
+        bool at_end() const { return pos == bytes.size(); }
+    };
+
+    /**
+     * A hash of the program that does not change between runs, so that a
+     * checkpoint is not resumed for a different program
+     */
+    size_t program_hash(const Node ast)
+    {
+        std::string print;
+        fingerprint(ast, print);
+
+        // FNV-1a
+        size_t hash = 0xcbf29ce484222325;
+        for (char c : print)
+        {
+            hash ^= uint8_t(c);
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    constexpr size_t shape_size = 6;
+
+    /**
+     * Add the options that decide which parts of the scheduling tree are
+     * explored. Resuming with different options would mix two searches.
+     */
+    void add_shape(CheckpointWriter &writer, const bytecode::ProgramPtr &program, const ExploreOptions &options)
+    {
+        writer.add(program_hash(program->ast));
+        writer.add(size_t(options.partial_order_reduction));
+        writer.add(size_t(options.sleep_sets));
+        writer.add(size_t(options.symmetry));
+        writer.add(options.max_preemptions);
+        writer.add(options.max_depth);
+    }
+
+    /**
+     * Save the state of a serial exploration at the top of its loop, where
+     * the last node of the path is the cursor.
+     */
+    void save_checkpoint(const bytecode::ProgramPtr &program, const ExploreOptions &options,
+                         const std::vector<Branch> &path, const ExplorationResult &result)
+    {
+        CheckpointWriter writer;
+        writer.add(checkpoint_version);
+        add_shape(writer, program, options);
+
+        writer.add(result.no_states);
+        writer.add(size_t(result.bounded));
+
+        // Failing and deadlocked traces are final traces, in the same order
+        writer.add(result.final_traces.size());
+        size_t failing = 0, deadlocked = 0;
+        for (const auto &trace : result.final_traces)
+        {
+            auto outcome = Outcome::completed;
+            if (failing < result.failing_traces.size() && result.failing_traces[failing] == trace)
+            {
+                outcome = Outcome::crashed;
+                failing++;
+            }
+            else if (deadlocked < result.deadlocked_traces.size() && result.deadlocked_traces[deadlocked] == trace)
+            {
+                outcome = Outcome::deadlocked;
+                deadlocked++;
+            }
+            writer.add(size_t(outcome));
+            writer.add_all(trace);
+        }
+
+        writer.add(path.size());
+        for (const auto &branch : path)
+        {
+            auto &node = branch.node;
+            writer.add(node.tid_);
+            writer.add(node.no_children);
+            for (ThreadID tid = 0; tid < node.explored_tids.size(); ++tid)
+            {
+                if (node.explored(tid))
+                    writer.add(tid);
+            }
+            writer.add(node.next_tid);
+
+            writer.add(size_t(node.event.has_value()));
+            if (node.event)
+                writer.add(*node.event);
+            writer.add_all(node.clock);
+            writer.add(node.no_threads);
+            writer.add_all(node.enabled);
+            writer.add_all(node.backtrack);
+            writer.add_events(node.sleep);
+            writer.add_events(node.done);
+
+            writer.add(branch.preemptions);
+            writer.add(size_t(branch.last_runnable));
+        }
+
+        writer.write(options.checkpoint);
+        verbose << "Saved checkpoint to " << options.checkpoint << std::endl;
+    }
+
+    /**
+     * Load a checkpoint saved by `save_checkpoint`, replaying its trace in
+     * `gctx` and adding its final traces to `result`. Returns the path from
+     * the root to the cursor.
+     */
+    std::vector<Branch> load_checkpoint(const bytecode::ProgramPtr &program, const ExploreOptions &options,
+                                        GlobalContext &gctx, ExplorationResult &result)
+    {
+        CheckpointReader reader(options.checkpoint);
+        if (auto version = reader.number(); version != checkpoint_version)
+            throw std::runtime_error("Unsupported checkpoint version " + std::to_string(version));
+
+        CheckpointWriter expected, found;
+        add_shape(expected, program, options);
+        for (size_t i = 0; i < shape_size; ++i)
+            found.add(reader.number());
+        if (found.view() != expected.view())
+            throw std::runtime_error("Checkpoint was saved for a different program or different exploration options");
+
+        result.no_states = reader.number();
+        result.bounded = reader.number();
+
+        for (size_t i = reader.number(); i > 0; --i)
+        {
+            auto outcome = reader.number();
+            if (outcome < size_t(Outcome::completed) || outcome > size_t(Outcome::deadlocked))
+                throw std::runtime_error("Checkpoint is truncated or corrupt");
+            auto trace = reader.numbers();
+            result.record(replay_trace(program, trace, false), trace, Outcome(outcome));
+        }
+
+        std::vector<Branch> path;
+        for (size_t depth = reader.number(); depth > 0; --depth)
+        {
+            TraceNode node(reader.number());
+            for (auto tid : reader.numbers())
+                node.extend(tid);
+            node.next_tid = reader.number();
+
+            if (reader.number())
+                node.event = reader.event();
+            node.clock = reader.numbers();
+            node.no_threads = reader.number();
+            node.enabled = reader.numbers();
+            auto backtrack = reader.numbers();
+            node.backtrack.insert(backtrack.begin(), backtrack.end());
+            node.sleep = reader.events();
+            node.done = reader.events();
+
+            auto preemptions = reader.number();
+            bool last_runnable = reader.number();
+
+            if (path.empty() ? node.tid_ != 0 : !path.back().node.explored(node.tid_))
+                throw std::runtime_error("Checkpoint is truncated or corrupt");
+            if (node.tid_ >= gctx.threads.size())
+                throw std::runtime_error("Checkpoint is truncated or corrupt");
+
+            auto tid = node.tid_;
+            verbose << "==== Thread " << tid << " (replay) ====" << std::endl;
+            progress_thread(gctx, tid, gctx.threads[tid]);
+            path.push_back({std::move(node), gctx.snapshot(), preemptions, last_runnable});
+        }
+
+        if (path.empty() || !reader.at_end())
+            throw std::runtime_error("Checkpoint is truncated or corrupt");
+
+        verbose << "Resumed from checkpoint " << options.checkpoint << " at depth " << path.size() << std::endl;
+        return path;
+    }
+}
@@ -0,0 +1,191 @@
+#include "bytecode.hh"
+
+namespace gitmem
+{
+    using namespace trieste;
+
+    namespace bytecode
+    {
+        const Code &compile_block(const Node &block, Program &program);
+
+        VarID intern(const Node &var, Program &program)
+        {
+            auto name = std::string(var->location().view());
+            auto [it, inserted] = program.var_ids.try_emplace(name, program.vars.size());
+            if (inserted)
+                program.vars.push_back(name);
+            return it->second;
+        }
+
+        size_t allocate_register(const Node &reg, Code &code)
+        {
+            auto name = std::string(reg->location().view());
+            auto [it, inserted] = code.reg_slots.try_emplace(name, code.regs.size());
+            if (inserted)
+                code.regs.push_back(name);
+            return it->second;
+        }
+
+        /* Append the postfix operations of an expression to `code` and
+         * return the depth of the value stack needed to evaluate it.
+         */
+        size_t compile_expression(const Node &expr, Code &code, Program &program)
+        {
+            auto e = expr / Expr;
+            if (e == Reg)
+            {
+                code.exprs.push_back({.op = ExprOp::Reg, .slot = allocate_register(expr, code)});
+                return 1;
+            }
+            else if (e == Var)
+            {
+                code.exprs.push_back({.op = ExprOp::Var, .var = intern(expr, program)});
+                return 1;
+            }
+            else if (e == Const)
+            {
+                code.exprs.push_back({.op = ExprOp::Const, .value = size_t(std::stoi(std::string(e->location().view())))});
+                return 1;
+            }
+            else if (e == Spawn)
+            {
+                auto block = e / Block;
+                auto &spawned = compile_block(block, program);
+                code.exprs.push_back({.op = ExprOp::Spawn, .block = block, .code = &spawned});
+                return 1;
+            }
+            else if (e == Add)
+            {
+                // Operand i is evaluated with i values already on the stack
+                size_t depth = 0;
+                size_t i = 0;
+                for (auto &child : *e)
+                    depth = std::max(depth, i++ + compile_expression(child, code, program));
+                code.exprs.push_back({.op = ExprOp::Add, .value = e->size()});
+                return depth;
+            }
+            else if (e == Eq || e == Neq)
+            {
+                auto lhs = compile_expression(e / Lhs, code, program);
+                auto rhs = compile_expression(e / Rhs, code, program);
+                code.exprs.push_back({.op = e == Eq ? ExprOp::Eq : ExprOp::Neq});
+                return std::max(lhs, 1 + rhs);
+            }
+            else
+            {
+                throw std::runtime_error("Unknown expression: " + std::string(expr->type().str()));
+            }
+        }
+
+        Instr compile_statement(const Node &stmt, Code &code, Program &program)
+        {
+            Instr instr;
+            auto s = stmt / Stmt;
+
+            auto compile_operand = [&](const Node &expr)
+            {
+                instr.expr = expr;
+                instr.expr_begin = uint32_t(code.exprs.size());
+                code.max_stack = std::max(code.max_stack, compile_expression(expr, code, program));
+                instr.expr_end = uint32_t(code.exprs.size());
+            };
+
+            if (s == Nop)
+            {
+                instr.op = Op::Nop;
+            }
+            else if (s == Jump)
+            {
+                instr.op = Op::Jump;
+                instr.delta = std::stoi(std::string((s / Const)->location().view()));
+                assert(instr.delta > 0);
+            }
+            else if (s == Cond)
+            {
+                instr.op = Op::Cond;
+                instr.delta = std::stoi(std::string((s / Const)->location().view()));
+                assert(instr.delta > 0);
+                compile_operand(s / Expr);
+            }
+            else if (s == Assign)
+            {
+                auto lhs = s / LVal;
+                if (lhs == Reg)
+                {
+                    instr.op = Op::AssignReg;
+                    instr.slot = allocate_register(lhs, code);
+                }
+                else if (lhs == Var)
+                {
+                    instr.op = Op::AssignVar;
+                    instr.var = intern(lhs, program);
+                }
+                else
+                {
+                    throw std::runtime_error("Bad left-hand side: " + std::string(lhs->type().str()));
+                }
+                compile_operand(s / Expr);
+            }
+            else if (s == Join)
+            {
+                instr.op = Op::Join;
+                compile_operand(s / Expr);
+            }
+            else if (s == Lock || s == Unlock)
+            {
+                instr.op = s == Lock ? Op::Lock : Op::Unlock;
+                instr.name = std::string((s / Var)->location().view());
+            }
+            else if (s == Assert)
+            {
+                instr.op = Op::Assert;
+                compile_operand(s / Expr);
+            }
+            else
+            {
+                throw std::runtime_error("Unknown statement: " + std::string(stmt->type().str()));
+            }
+            return instr;
+        }
+
+        const Code &compile_block(const Node &block, Program &program)
+        {
+            auto &code = program.blocks[block];
+            if (code)
+                return *code;
+
+            code = std::make_unique<Code>();
+            code->instrs.reserve(block->size());
+            for (auto &stmt : *block)
+                code->instrs.push_back(compile_statement(stmt, *code, program));
+
+            // A step runs up to the next syncing instruction on any path, and
+            // jumps only go forward, so one backward pass finds the steps
+            // that can reach a spawn
+            auto &instrs = code->instrs;
+            auto continues_to_spawn = [&instrs](size_t target)
+            {
+                return target < instrs.size() && !instrs[target].is_syncing() && instrs[target].step_spawns;
+            };
+            for (size_t pc = instrs.size(); pc-- > 0;)
+            {
+                auto &instr = instrs[pc];
+                for (auto i = instr.expr_begin; i < instr.expr_end; ++i)
+                    instr.step_spawns |= code->exprs[i].op == ExprOp::Spawn;
+                if (instr.op != Op::Jump)
+                    instr.step_spawns |= continues_to_spawn(pc + 1);
+                if (instr.op == Op::Jump || instr.op == Op::Cond)
+                    instr.step_spawns |= continues_to_spawn(pc + instr.delta);
+            }
+            return *code;
+        }
+
+        ProgramPtr compile(const Node &ast)
+        {
+            auto program = std::make_shared<Program>();
+            program->ast = ast;
+            compile_block(program->entry(), *program);
+            return program;
+        }
+    }
+}
@@ -27,10 +27,13 @@ namespace gitmem
     {
         std::cout << var << " = " << global.val
                   << " [" << (global.commit ? std::to_string(*global.commit) : "_") << "; ";
-        for (size_t i = 0; i < global.history.size(); ++i)
+        std::vector<Commit> history;
+        for (auto commit : global.history)
+            history.push_back(commit);
+        for (size_t i = history.size(); i-- > 0;)
         {
-            std::cout << global.history[i];
-            if (i < global.history.size() - 1)
+            std::cout << history[i];
+            if (i > 0)
             {
                 std::cout << ", ";
             }
@@ -40,23 +43,23 @@ namespace gitmem
 
     /** Print the state of a thread, including its local and global variables,
      * and the current position in the program. */
-    void show_thread(const Thread &thread, size_t tid)
+    void show_thread(const GlobalContext &gctx, const Thread &thread, size_t tid)
     {
         std::cout << "---- Thread " << tid << std::endl;
-        if (thread.ctx.locals.size() > 0)
+        if (!thread.ctx.locals.empty())
         {
-            for (auto &[reg, val] : thread.ctx.locals)
+            for (auto [slot, val] : thread.ctx.locals)
             {
-                std::cout << reg << " = " << val << std::endl;
+                std::cout << thread.code->regs[slot] << " = " << val << std::endl;
             }
             std::cout << "--" << std::endl;
         }
 
         if (thread.ctx.globals.size() > 0)
         {
-            for (auto &[var, val] : thread.ctx.globals)
+            for (auto [var, val] : thread.ctx.globals)
             {
-                show_global(var, val);
+                show_global(gctx.var_name(var), val);
             }
             std::cout << "--" << std::endl;
         }
@@ -85,7 +88,7 @@ namespace gitmem
         }
     }
 
-    void show_lock(const std::string &lock_name, const struct Lock &lock)
+    void show_lock(const GlobalContext &gctx, const std::string &lock_name, const struct Lock &lock)
     {
         std::cout << lock_name << ": ";
         if (lock.owner)
@@ -97,9 +100,9 @@ namespace gitmem
             std::cout << "<free>";
         }
         std::cout << std::endl;
-        for (auto &[var, global] : lock.globals)
+        for (auto [var, global] : lock.globals)
         {
-            show_global(var, global);
+            show_global(gctx.var_name(var), global);
         }
     }
 
@@ -115,7 +118,7 @@ namespace gitmem
             auto thread = threads[i];
             if (show_all || !thread->terminated || *threads[i]->terminated != TerminationStatus::completed)
             {
-                show_thread(*threads[i], i);
+                show_thread(gctx, *threads[i], i);
                 std::cout << std::endl;
                 showed_any = true;
             }
@@ -127,7 +130,7 @@ namespace gitmem
 
             for (const auto &[lock_name, lock] : gctx.locks)
             {
-                show_lock(lock_name, lock);
+                show_lock(gctx, lock_name, lock);
             }
 
             if (gctx.locks.size() > 0)
@@ -229,6 +232,8 @@ namespace gitmem
             {
                 auto stmt = thread->block->at(thread->pc);
                 msg = "Thread " + std::to_string(tid) + " is blocking on '" + std::string(stmt->location().view()) + "'";
+                if (gctx.deadlock)
+                    msg += " in a deadlock: " + describe_deadlock(*gctx.deadlock);
                 return false;
             }
         }
@@ -267,7 +272,8 @@ namespace gitmem
      * thread to schedule next. */
     int interpret_interactive(const Node ast, const std::filesystem::path &output_file)
     {
-        GlobalContext gctx(ast);
+        auto program = bytecode::compile(ast);
+        GlobalContext gctx(program);
 
         size_t prev_no_threads = 1;
         Command command = {Command::List};
@@ -325,7 +331,7 @@ namespace gitmem
             else if (command.cmd == Command::Restart)
             {
                 // Start the program from the beginning
-                gctx = GlobalContext(ast);
+                gctx = GlobalContext(program);
                 command = {Command::List};
                 if (print_graphs)
                 {
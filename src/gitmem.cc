@@ -25,19 +25,154 @@ int main(int argc, char **argv)
         "Enable verbose output from the interpreter."
     );
 
+    bool vector_clocks = false;
+    app.add_flag(
+        "--vector-clocks",
+        vector_clocks,
+        "Detect data races by comparing vector clocks instead of commit histories."
+    );
+
     // TODO: These should probably be subcommands
     bool interactive = false;
-    app.add_flag(
+    auto interactive_flag = app.add_flag(
         "-i,--interactive",
         interactive,
         "Enable interactive scheduling mode (use command ? for help).");
 
     bool model_check = false;
-    app.add_flag(
+    auto explore_flag = app.add_flag(
         "-e,--explore",
         model_check,
         "Explore all possible execution paths.");
 
+    bool quick = false;
+    app.add_flag(
+        "--quick",
+        quick,
+        "Only look for candidate data races with a lockset analysis, without running the program.")
+        ->excludes(interactive_flag)
+        ->excludes(explore_flag);
+
+    gitmem::ExploreOptions explore_options;
+    app.add_flag(
+        "--stats",
+        explore_options.print_stats,
+        "Report exploration statistics (use with -e).");
+
+    auto por = app.add_flag(
+        "--por",
+        explore_options.partial_order_reduction,
+        "Use dynamic partial-order reduction to skip schedules that only reorder independent steps (use with -e).");
+
+    auto jobs = app.add_option(
+        "-j,--jobs",
+        explore_options.jobs,
+        "Number of threads exploring execution paths in parallel (use with -e).")
+        ->check(CLI::PositiveNumber)
+        ->excludes(por);
+
+    auto stateful = app.add_flag(
+        "--stateful",
+        explore_options.stateful,
+        "Do not explore states that have been reached by another schedule (use with -e).")
+        ->excludes(por)
+        ->excludes(jobs);
+
+    auto symmetry = app.add_flag(
+        "--symmetry",
+        explore_options.symmetry,
+        "Only schedule one of several threads running identical code in the same state (use with -e).")
+        ->excludes(por);
+
+    auto sleep_sets = app.add_flag(
+        "--sleep-sets",
+        explore_options.sleep_sets,
+        "Do not take steps that a sibling schedule has already taken before independent steps (use with -e).")
+        ->excludes(stateful);
+
+    auto max_preemptions = app.add_option(
+        "--max-preemptions",
+        explore_options.max_preemptions,
+        "Only explore traces that switch away from a runnable thread at most this many times (use with -e).")
+        ->check(CLI::NonNegativeNumber)
+        ->excludes(por)
+        ->excludes(symmetry)
+        ->excludes(sleep_sets);
+
+    auto max_depth = app.add_option(
+        "--max-depth",
+        explore_options.max_depth,
+        "Only explore traces of at most this many steps (use with -e).")
+        ->check(CLI::PositiveNumber)
+        ->excludes(por);
+
+    auto sample = app.add_option(
+        "--sample",
+        explore_options.samples,
+        "Run this many random schedules instead of exploring all of them (use with -e).")
+        ->check(CLI::PositiveNumber)
+        ->excludes(por)
+        ->excludes(jobs)
+        ->excludes(stateful)
+        ->excludes(symmetry)
+        ->excludes(sleep_sets)
+        ->excludes(max_preemptions)
+        ->excludes(max_depth);
+
+    app.add_option(
+        "--seed",
+        explore_options.seed,
+        "Seed of the first random schedule, the failing schedules report their own seeds (use with --sample).")
+        ->needs(sample);
+
+    app.add_option(
+        "--pct-depth",
+        explore_options.pct_depth,
+        "Number of ordering constraints that a bug found by sampling may need (use with --sample).")
+        ->check(CLI::PositiveNumber)
+        ->needs(sample);
+
+    auto shortest = app.add_flag(
+        "--shortest",
+        explore_options.shortest,
+        "Report a shortest trace for each kind of failure, exploring shorter traces first (use with -e).")
+        ->excludes(por)
+        ->excludes(sample);
+
+    app.add_flag(
+        "--first-error",
+        explore_options.first_error,
+        "Stop at the first trace that crashes or deadlocks and only report that trace (use with -e).");
+
+    auto checkpoint = app.add_option(
+        "--checkpoint",
+        explore_options.checkpoint,
+        "File to periodically save the exploration to, so that it can be resumed (use with -e).")
+        ->excludes(jobs)
+        ->excludes(stateful)
+        ->excludes(sample)
+        ->excludes(shortest);
+
+    app.add_option(
+        "--checkpoint-interval",
+        explore_options.checkpoint_interval,
+        "Seconds between two checkpoints (use with --checkpoint).")
+        ->check(CLI::NonNegativeNumber)
+        ->needs(checkpoint);
+
+    app.add_flag(
+        "--resume",
+        explore_options.resume,
+        "Continue the exploration saved in the checkpoint file (use with --checkpoint).")
+        ->needs(checkpoint);
+
+    app.add_option(
+        "--visited-limit",
+        explore_options.visited_limit_mb,
+        "Memory in MB for remembering visited states (use with --stateful).")
+        ->check(CLI::PositiveNumber)
+        ->needs(stateful);
+
     try
     {
         app.parse(argc, argv);
@@ -50,6 +185,8 @@ int main(int argc, char **argv)
     try
     {
         gitmem::verbose.enabled = verbose;
+        if (vector_clocks)
+            gitmem::race_detection = gitmem::RaceDetection::vector_clocks;
 
         gitmem::verbose << "Reading file " << input_path << std::endl;
         if (!std::filesystem::exists(input_path))
@@ -76,9 +213,13 @@ int main(int argc, char **argv)
 
         int exit_status;
         wf::push_back(gitmem::wf);
-        if (model_check)
+        if (quick)
+        {
+            exit_status = gitmem::quick_check(result.ast);
+        }
+        else if (model_check)
         {
-            exit_status = gitmem::model_check(result.ast, output_path);
+            exit_status = gitmem::model_check(result.ast, output_path, explore_options);
         }
         else if (interactive)
         {
@@ -31,7 +31,7 @@ namespace gitmem {
 
     struct Conflict
     {
-        std::string var;
+        size_t var;
         std::pair<std::shared_ptr<Node>, std::shared_ptr<Node>> sources;
     };
 
@@ -74,11 +74,11 @@ namespace gitmem {
 
     struct Write : Node
     {
-      const std::string var;
+      const size_t var;
       const size_t value;
       const size_t id;
 
-      Write(const std::string var, const size_t value, const size_t id): var(var), value(value), id(id) {}
+      Write(const size_t var, const size_t value, const size_t id): var(var), value(value), id(id) {}
 
       void accept(Visitor* v) const override
       {
@@ -88,13 +88,13 @@ namespace gitmem {
 
     struct Read : Node
     {
-      const std::string var;
+      const size_t var;
       const size_t value;
       const size_t id;
       const std::shared_ptr<const Node> sauce;
 
 
-      Read(const std::string var, const size_t value, const size_t id, const std::shared_ptr<const Node> sauce): var(var), value(value), id(id), sauce(sauce) {}
+      Read(const size_t var, const size_t value, const size_t id, const std::shared_ptr<const Node> sauce): var(var), value(value), id(id), sauce(sauce) {}
 
       void accept(Visitor* v) const override
       {
@@ -52,7 +52,7 @@ namespace graph {
     emitConflictEdge(n, s2.get());
   }
 
-  GraphvizPrinter::GraphvizPrinter(std::string filename) noexcept {
+  GraphvizPrinter::GraphvizPrinter(std::string filename, const std::vector<std::string>& vars) noexcept : vars(vars) {
     file.open(filename);
   }
 
@@ -89,13 +89,13 @@ namespace graph {
   }
 
   void GraphvizPrinter::visitWrite(const Write* n) {
-    emitNode(n, "W" + n->var + " = " + to_string(n->value));
+    emitNode(n, "W" + vars[n->var] + " = " + to_string(n->value));
     emitProgramOrderEdge(n, n->next.get());
     visitProgramOrder(n->next.get());
   }
 
   void GraphvizPrinter::visitRead(const Read* n) {
-    emitNode(n, "R" + n->var + " = " + to_string(n->value));
+    emitNode(n, "R" + vars[n->var] + " = " + to_string(n->value));
     emitProgramOrderEdge(n, n->next.get());
     visitProgramOrder(n->next.get());
 
@@ -16,9 +16,10 @@ namespace gitmem {
       void visitPending(const Pending*) override;
       void visit(const Node* n) override;
 
-      GraphvizPrinter(std::string filename) noexcept;
+      GraphvizPrinter(std::string filename, const std::vector<std::string>& vars) noexcept;
     private:
       std::ofstream file;
+      const std::vector<std::string>& vars; // The names of global variable IDs
       void emitNode(const Node* n, const std::string& label, const std::string& style = "");
       void emitEdge(const Node* from, const Node* to, const std::string& label, const std::string& style = "");
       void emitProgramOrderEdge(const Node* from, const Node* to);
@@ -23,30 +23,26 @@ namespace gitmem
      * - t unlocking a lock l, which updates l to have t's versioned memory
      */
 
-    bool is_syncing(Node stmt)
-    {
-        auto s = stmt / Stmt;
-        return s == Join || s == Lock || s == Unlock;
-    }
-
     bool is_syncing(Thread &thread)
     {
-        return !thread.terminated && is_syncing(thread.block->at(thread.pc));
+        return !thread.terminated && thread.code->instrs[thread.pc].is_syncing();
     }
 
-    /* At a commit point, walk through all the versioned variables and see if
-     * they have a pending commit, if so commit the value by appending to
-     * the variables history.
+    /* At a commit point, walk through the versioned variables that the thread
+     * has written since its last commit point and commit their values by
+     * appending to the variables' histories. Variables that have not been
+     * written are not touched, so globals that are shared with other
+     * objects stay shared.
      */
-    void commit(Globals &globals) {
-        for (auto& [var, global] : globals) {
-            if (global.commit)
-            {
-                global.history.push_back(*global.commit);
-                verbose << "Committed global '" << var << "' with id " << *global.commit << std::endl;
-                global.commit.reset();
-            }
+    void commit(const GlobalContext &gctx, ThreadContext &ctx) {
+        for (auto var : ctx.dirty) {
+            auto &global = ctx.globals[var];
+            assert(global.commit);
+            global.history.push_back(*global.commit, ctx.tid);
+            verbose << "Committed global '" << gctx.var_name(var) << "' with id " << *global.commit << std::endl;
+            global.commit.reset();
         }
+        ctx.dirty.clear();
     }
 
 
@@ -55,21 +51,25 @@ namespace gitmem
      * A conflict between two commit histories exists if neither history is a
      * prefix of the other.
      */
-    std::optional<std::pair<Commit, Commit>> has_conflict(CommitHistory& h1, CommitHistory& h2)
+    std::optional<std::pair<Commit, Commit>> has_conflict(const CommitHistory& h1, const CommitHistory& h2)
     {
-        size_t length = std::min(h1.size(), h2.size());
-
-        for (size_t i = 0; i < length; i++)
+        // With vector clocks, the clocks decide whether there is a conflict
+        // and the histories are only walked to find the conflicting commits.
+        // Debug builds check that both backends agree.
+        if (race_detection == RaceDetection::vector_clocks)
         {
-            if (h1[i] != h2[i]) return std::pair<Commit, Commit>{h1[i], h2[i]};
+            bool ordered = h1.precedes(h2) || h2.precedes(h1);
+            assert(ordered == !h1.first_difference(h2));
+            if (ordered)
+                return std::nullopt;
         }
 
-        return std::nullopt;
+        return h1.first_difference(h2);
     }
 
     struct Conflict
     {
-        std::string var;
+        VarID var;
         std::pair<Commit, Commit> commits;
     };
 
@@ -78,29 +78,39 @@ namespace gitmem
      * either source or destination). This means destination will now also
      * include variables it previously did not know about.
      */
-    std::optional<Conflict> pull(Globals &dst, Globals &src) {
-        for (auto& [var, global] : src) {
+    std::optional<Conflict> pull(const GlobalContext &gctx, Globals &dst, const Globals &src) {
+        if (dst.shares_storage(src))
+            return std::nullopt;
+
+        for (auto [var, src_var] : src) {
             if (dst.contains(var))
             {
-                auto& src_var = src[var];
-                auto& dst_var = dst[var];
+                // The history of a variable acts as its version stamp: if
+                // both sides still hold the same history there is nothing
+                // to pull
+                auto& dst_var = dst.at(var);
+                if (src_var.history.same_as(dst_var.history))
+                    continue;
+
                 if (auto conflict = has_conflict(src_var.history, dst_var.history))
                 {
                     auto [s1, s2] = *conflict;
-                    verbose << "A data race on '" << var << "' was detected from commits " << s1 << " and " << s2 << std::endl;
+                    verbose << "A data race on '" << gctx.var_name(var) << "' was detected from commits " << s1 << " and " << s2 << std::endl;
                     return Conflict(var, *conflict);
                 }
                 else if (src_var.history.size() > dst_var.history.size())
                 {
-                    verbose << "Fast-forward '" << var << "' to id " << src_var.val << std::endl;
-                    dst_var.val = src_var.val;
-                    dst_var.history = src_var.history;
+                    verbose << "Fast-forward '" << gctx.var_name(var) << "' to id " << src_var.val << std::endl;
+                    auto& updated = dst[var];
+                    updated.val = src_var.val;
+                    updated.history = src_var.history;
                 }
             }
             else
             {
-                dst[var].val = src[var].val;
-                dst[var].history = src[var].history;
+                auto& added = dst[var];
+                added.val = src_var.val;
+                added.history = src_var.history;
             }
         }
         return std::nullopt;
@@ -128,175 +138,179 @@ namespace gitmem
     }
 
     /* Evaluating an expression either returns the result of the expression or
-     * a the exceptional termination status of the thread.
+     * a the exceptional termination status of the thread. The postfix
+     * operations of the expression are run on a value stack.
      */
-    std::variant<size_t, TerminationStatus> evaluate_expression(Node expr, GlobalContext &gctx, ThreadContext &ctx)
+    std::variant<size_t, TerminationStatus> evaluate_expression(const bytecode::Code &code, const bytecode::Instr &instr, GlobalContext &gctx, ThreadContext &ctx)
     {
-        auto e = expr / Expr;
-        if (e == Reg)
+        using bytecode::ExprOp;
+
+        // The stack is reused between evaluations so that evaluating does
+        // not allocate
+        thread_local std::vector<size_t> stack;
+        if (stack.size() < code.max_stack)
+            stack.resize(code.max_stack);
+
+        size_t sp = 0;
+        for (auto i = instr.expr_begin; i < instr.expr_end; ++i)
         {
-            // It is invalid to read a previously unwritten value
-            auto var = std::string(expr->location().view());
-            if (ctx.locals.contains(var))
+            auto &e = code.exprs[i];
+            switch (e.op)
             {
-                return ctx.locals[var];
-            }
-            else
+            case ExprOp::Const:
+                stack[sp++] = e.value;
+                break;
+
+            case ExprOp::Reg:
             {
-                return TerminationStatus::unassigned_variable_read_exception;
+                // It is invalid to read a previously unwritten value
+                if (!ctx.locals.contains(e.slot))
+                    return TerminationStatus::unassigned_variable_read_exception;
+                stack[sp++] = ctx.locals.at(e.slot);
+                break;
             }
-        }
-        else if (e == Var)
-        {
-            // It is invalid to read a previously unwritten value
-            auto var = std::string(expr->location().view());
-            if (ctx.globals.contains(var))
+
+            case ExprOp::Var:
             {
-                auto& global = ctx.globals[var];
-                auto commit = global.commit.value_or(global.history.back());
-                auto source_node = gctx.commit_map[commit];
-                thread_append_node<graph::Read>(ctx, var, global.val, commit, source_node);
-                return global.val;
+                // It is invalid to read a previously unwritten value
+                if (!ctx.globals.contains(e.var))
+                    return TerminationStatus::unassigned_variable_read_exception;
+
+                auto& global = ctx.globals.at(e.var);
+                if (gctx.record_graph)
+                {
+                    auto commit = global.commit.value_or(global.history.back());
+                    auto source_node = gctx.commit_map[commit];
+                    thread_append_node<graph::Read>(ctx, e.var, global.val, commit, source_node);
+                }
+                stack[sp++] = global.val;
+                break;
             }
-            else
+
+            case ExprOp::Spawn:
             {
-                return TerminationStatus::unassigned_variable_read_exception;
+                // Spawning is a sync point, commit local pending commits, and
+                // copy the global state to the spawned thread
+                commit(gctx, ctx);
+                ThreadID tid = gctx.threads.size();
+                std::shared_ptr<graph::Start> node;
+                if (gctx.record_graph)
+                    node = std::make_shared<graph::Start>(tid);
+
+                ThreadContext new_ctx = { Locals(e.code->regs.size()), ctx.globals, node, tid };
+                gctx.threads.push_back(std::make_shared<Thread>(new_ctx, e.block, e.code));
+                gctx.runnable.insert(tid);
+
+                if (gctx.record_graph)
+                    thread_append_node<graph::Spawn>(ctx, tid, node);
+
+                stack[sp++] = tid;
+                break;
             }
-        }
-        else if (e == Const)
-        {
-            return size_t(std::stoi(std::string(e->location().view())));
-        }
-        else if (e == Add)
-        {
-            size_t sum = 0;
-            for (auto &child : *e)
+
+            case ExprOp::Add:
             {
-                auto result = evaluate_expression(child, gctx, ctx);
-                if (std::holds_alternative<TerminationStatus>(result)) return result;
-                sum += std::get<size_t>(result);
+                size_t sum = 0;
+                for (size_t k = 0; k < e.value; ++k)
+                    sum += stack[--sp];
+                stack[sp++] = sum;
+                break;
             }
-            return sum;
-        }
-        else if (e == Spawn)
-        {
-            // Spawning is a sync point, commit local pending commits, and
-            // copy the global state to the spawned thread
-            commit(ctx.globals);
-            ThreadID tid = gctx.threads.size();
-            auto node = std::make_shared<graph::Start>(tid);
-
-            ThreadContext new_ctx = { Locals(), ctx.globals, node };
-            gctx.threads.push_back(std::make_shared<Thread>(new_ctx, e / Block));
 
-            thread_append_node<graph::Spawn>(ctx, tid, node);
-
-            return tid;
+            case ExprOp::Eq:
+            case ExprOp::Neq:
+            {
+                auto rhs = stack[--sp];
+                auto lhs = stack[--sp];
+                stack[sp++] = e.op == ExprOp::Eq ? lhs == rhs : lhs != rhs;
+                break;
+            }
+            }
         }
-        else if (e == Eq || e == Neq)
-        {
-            auto lhs = e / Lhs;
-            auto rhs = e / Rhs;
-
-            auto lhsEval = evaluate_expression(lhs, gctx, ctx);
-            if (std::holds_alternative<TerminationStatus>(lhsEval)) return lhsEval;
 
-            auto rhsEval = evaluate_expression(rhs, gctx, ctx);
-            if (std::holds_alternative<TerminationStatus>(rhsEval)) return rhsEval;
-
-            return e == Eq? (std::get<size_t>(lhsEval)) == (std::get<size_t>(rhsEval))
-                          : (std::get<size_t>(lhsEval)) != (std::get<size_t>(rhsEval));
-        }
-        else
-        {
-            throw std::runtime_error("Unknown expression: " + std::string(expr->type().str()));
-        }
+        assert(sp == 1);
+        return stack[0];
     }
 
     /* Evaluating a statement either returns the resulting change of the program
      * counter (0 if waiting for some other thread) or the exceptional
      * termination status of the thread.
      */
-    std::variant<int, TerminationStatus> run_statement(Node stmt, GlobalContext &gctx, ThreadContext &ctx, const ThreadID& tid)
+    std::variant<int, TerminationStatus> run_statement(const bytecode::Code &code, const bytecode::Instr &instr, GlobalContext &gctx, ThreadContext &ctx, const ThreadID& tid)
     {
-        auto s = stmt / Stmt;
-        if (s == Nop)
+        using bytecode::Op;
+
+        switch (instr.op)
         {
+        case Op::Nop:
             verbose << "Nop" << std::endl;
-        }
-        else if (s == Jump)
-        {
-            auto cnst = s / Const;
-            auto delta = std::stoi(std::string(cnst->location().view()));
-            assert(delta > 0);
-            return delta;
-        }
-        else if (s == Cond)
-        {
-            auto expr = s / Expr;
-            auto cnst = s / Const;
-            auto result = evaluate_expression(expr, gctx, ctx);
+            break;
 
+        case Op::Jump:
+            return instr.delta;
+
+        case Op::Cond:
+        {
+            auto result = evaluate_expression(code, instr, gctx, ctx);
             if (auto b = std::get_if<size_t>(&result))
             {
-                auto delta = std::stoi(std::string(cnst->location().view()));
-                assert(delta > 0);
-                return *b? 1 : delta;
+                return *b? 1 : instr.delta;
             }
             else
             {
                 return std::get<TerminationStatus>(result);
             }
         }
-        else if (s == Assign)
+
+        case Op::AssignReg:
+        case Op::AssignVar:
         {
-            auto lhs = s / LVal;
-            auto var = std::string(lhs->location().view());
-            auto rhs = s / Expr;
-            auto val_or_term = evaluate_expression(rhs, gctx, ctx);
+            auto val_or_term = evaluate_expression(code, instr, gctx, ctx);
             if(size_t* val = std::get_if<size_t>(&val_or_term))
             {
-                if (lhs == Reg)
+                if (instr.op == Op::AssignReg)
                 {
                     // Local variables can be re-assigned whenever
-                    verbose << "Set register '" << lhs->location().view() << "' to " << *val << std::endl;
-                    ctx.locals[var] = *val;
+                    verbose << "Set register '" << code.regs[instr.slot] << "' to " << *val << std::endl;
+                    ctx.locals.set(instr.slot, *val);
                 }
-                else if (lhs == Var)
+                else
                 {
                     // Global variable writes need to create a new commit id
                     // to track the history of updates
-                    auto &global = ctx.globals[var];
+                    auto &global = ctx.globals[instr.var];
+                    if (!global.commit)
+                        ctx.dirty.push_back(instr.var);
                     global.val = *val;
                     global.commit = gctx.uuid++;
-                    verbose <<  "Set global '" << lhs->location().view() << "' to " << *val <<  " with id " << *(global.commit) << std::endl;
+                    verbose <<  "Set global '" << gctx.var_name(instr.var) << "' to " << *val <<  " with id " << *(global.commit) << std::endl;
 
-                    auto node = thread_append_node<graph::Write>(ctx, var, global.val, *global.commit);
-                    gctx.commit_map[*(global.commit)] = node;
-                }
-                else
-                {
-                    throw std::runtime_error("Bad left-hand side: " + std::string(lhs->type().str()));
+                    if (gctx.record_graph)
+                    {
+                        auto node = thread_append_node<graph::Write>(ctx, instr.var, global.val, *global.commit);
+                        gctx.commit_map[*(global.commit)] = node;
+                    }
                 }
             }
             else
             {
                 return std::get<TerminationStatus>(val_or_term);
             }
+            break;
         }
-        else if (s == Join)
+
+        case Op::Join:
         {
             // A join must waiting for the terminating thread to continue,
             // we don't want to re-evaluate the expression repeatedly as this
             // may be effecting so store the result in the cache.
-            auto expr = s / Expr;
-
-            if (!gctx.cache.contains(expr))
+            auto it = gctx.cache.find(instr.expr);
+            if (it == gctx.cache.end())
             {
-                auto val_or_term = evaluate_expression(expr, gctx, ctx);
+                auto val_or_term = evaluate_expression(code, instr, gctx, ctx);
                 if (size_t* val = std::get_if<size_t>(&val_or_term))
                 {
-                    gctx.cache[expr] = *val;
+                    it = gctx.cache.emplace(instr.expr, *val).first;
                 }
                 else
                 {
@@ -307,73 +321,89 @@ namespace gitmem
             // when joining, we commit the updates of both threads (the joined
             // thread will not necessarily have commited them), we then
             // pull the updates into the joining thread.
-            auto result = gctx.cache[expr];
+            auto result = it->second;
+            if (result >= gctx.threads.size())
+            {
+                // The thread may still be spawned, so the joining thread is
+                // not parked but tried again
+                verbose << "Waiting on thread " << result << ", which has not been spawned" << std::endl;
+                return 0;
+            }
+
             auto& thread = gctx.threads[result];
             if (thread->terminated && (*thread->terminated == TerminationStatus::completed))
             {
-                commit(ctx.globals);
-                commit(thread->ctx.globals);
+                commit(gctx, ctx);
+                commit(gctx, thread->ctx);
                 verbose << "Pulling from thread " <<  result << std::endl;
-                if(auto conflict = pull(ctx.globals, thread->ctx.globals))
+                if(auto conflict = pull(gctx, ctx.globals, thread->ctx.globals))
                 {
-                    using graph::Node;
-                    auto [s1, s2] = conflict->commits;
-                    auto sources = std::pair<std::shared_ptr<Node>, std::shared_ptr<Node>>{gctx.commit_map[s1], gctx.commit_map[s2]};
-                    auto graph_conflict = graph::Conflict(conflict->var, sources);
-                    thread_append_node<graph::Join>(ctx, result, thread->ctx.tail, graph_conflict);
+                    if (gctx.record_graph)
+                    {
+                        using graph::Node;
+                        auto [s1, s2] = conflict->commits;
+                        auto sources = std::pair<std::shared_ptr<Node>, std::shared_ptr<Node>>{gctx.commit_map[s1], gctx.commit_map[s2]};
+                        auto graph_conflict = graph::Conflict(conflict->var, sources);
+                        thread_append_node<graph::Join>(ctx, result, thread->ctx.tail, graph_conflict);
+                    }
                     return TerminationStatus::datarace_exception;
                 }
 
-                thread_append_node<graph::Join>(ctx, result, thread->ctx.tail);
+                if (gctx.record_graph)
+                    thread_append_node<graph::Join>(ctx, result, thread->ctx.tail);
             }
             else
             {
                 verbose << "Waiting on thread " << result << std::endl;
+                gctx.park(tid, thread->joiners);
                 return 0;
             }
+            break;
         }
-        else if (s == Lock)
+
+        case Op::Lock:
         {
             // We can only lock unlocked locks, if a lock hasn't been used
             // before it is implicitly created, we then commit the pending
             // updates of this thread and pull the updates from the lock.
-            auto v = s / Var;
-            auto var = std::string(v->location().view());
-
-            auto& lock = gctx.locks[var];
+            auto& lock = gctx.locks[instr.name];
             if (lock.owner) {
-                verbose << "Waiting for lock " << var << " owned by " << lock.owner.value() << std::endl;
+                verbose << "Waiting for lock " << instr.name << " owned by " << lock.owner.value() << std::endl;
+                gctx.park(tid, lock.waiters);
                 return 0;
             }
 
             lock.owner = tid;
-            commit(ctx.globals);
-            if(auto conflict = pull(ctx.globals, lock.globals))
+            commit(gctx, ctx);
+            if(auto conflict = pull(gctx, ctx.globals, lock.globals))
             {
-                using graph::Node;
-                auto [s1, s2] = conflict->commits;
-                auto sources = std::pair<std::shared_ptr<Node>, std::shared_ptr<Node>>{gctx.commit_map[s1], gctx.commit_map[s2]};
-                auto graph_conflict = graph::Conflict(conflict->var, sources);
-                thread_append_node<graph::Lock>(ctx, var, lock.last, graph_conflict);
+                if (gctx.record_graph)
+                {
+                    using graph::Node;
+                    auto [s1, s2] = conflict->commits;
+                    auto sources = std::pair<std::shared_ptr<Node>, std::shared_ptr<Node>>{gctx.commit_map[s1], gctx.commit_map[s2]};
+                    auto graph_conflict = graph::Conflict(conflict->var, sources);
+                    thread_append_node<graph::Lock>(ctx, instr.name, lock.last, graph_conflict);
+                }
                 return TerminationStatus::datarace_exception;
             }
 
-            thread_append_node<graph::Lock>(ctx, var, lock.last);
-
-            verbose << "Locked " << var << std::endl;
+            if (gctx.record_graph)
+                thread_append_node<graph::Lock>(ctx, instr.name, lock.last);
 
+            verbose << "Locked " << instr.name << std::endl;
+            break;
         }
-        else if (s == Unlock)
+
+        case Op::Unlock:
         {
             // We can only unlock locks we previously locked. We commit any
             // pending updates and then copy the threads versioned globals
             // to the locks versioned globals (nobody could have changed
             // them since we locked the lock).
-            commit(ctx.globals);
-            auto v = s / Var;
-            auto var = std::string(v->location().view());
+            commit(gctx, ctx);
 
-            auto& lock = gctx.locks[var];
+            auto& lock = gctx.locks[instr.name];
             if (!lock.owner || (lock.owner && *lock.owner != tid))
             {
                 return TerminationStatus::unlock_exception;
@@ -381,26 +411,32 @@ namespace gitmem
 
             lock.globals = ctx.globals;
             lock.owner.reset();
+            gctx.wake(lock.waiters);
 
-            thread_append_node<graph::Unlock>(ctx, var);
-            lock.last = ctx.tail;
+            if (gctx.record_graph)
+            {
+                thread_append_node<graph::Unlock>(ctx, instr.name);
+                lock.last = ctx.tail;
+            }
 
-            verbose << "Unlocked " << var << std::endl;
+            verbose << "Unlocked " << instr.name << std::endl;
+            break;
         }
-        else if (s == Assert)
+
+        case Op::Assert:
         {
-            auto expr = s / Expr;
-            auto result_or_term = evaluate_expression(expr, gctx, ctx);
+            auto result_or_term = evaluate_expression(code, instr, gctx, ctx);
             if (size_t* result = std::get_if<size_t>(&result_or_term))
             {
                 if (*result)
                 {
-                    verbose << "Assertion passed: " << expr->location().view() << std::endl;
+                    verbose << "Assertion passed: " << instr.expr->location().view() << std::endl;
                 }
                 else
                 {
-                    verbose << "Assertion failed: " << expr->location().view() << std::endl;
-                    thread_append_node<graph::AssertionFailure>(ctx, std::string(expr->location().view()));
+                    verbose << "Assertion failed: " << instr.expr->location().view() << std::endl;
+                    if (gctx.record_graph)
+                        thread_append_node<graph::AssertionFailure>(ctx, std::string(instr.expr->location().view()));
                     return TerminationStatus::assertion_failure_exception;
                 }
             }
@@ -408,10 +444,8 @@ namespace gitmem
             {
                 return std::get<TerminationStatus>(result_or_term);
             }
+            break;
         }
-        else
-        {
-            throw std::runtime_error("Unknown statement: " + std::string(stmt->type().str()));
         }
         return 1;
     }
@@ -425,25 +459,26 @@ namespace gitmem
         if (thread->terminated) {
             return *(thread->terminated);
         }
-        Node block = thread->block;
+        const bytecode::Code &code = *thread->code;
         size_t &pc = thread->pc;
         ThreadContext &ctx = thread->ctx;
 
         bool first_statement = true;
-        while(pc < block->size())
+        while(pc < code.instrs.size())
         {
-            Node stmt = block->at(pc);
+            const bytecode::Instr &instr = code.instrs[pc];
 
-            if (!first_statement && is_syncing(stmt))
+            if (!first_statement && instr.is_syncing())
             {
                 return ProgressStatus::progress;
             }
 
-            auto delta_or_term = run_statement(stmt, gctx, ctx, tid);
+            auto delta_or_term = run_statement(code, instr, gctx, ctx, tid);
             if (auto term = std::get_if<TerminationStatus>(&delta_or_term))
             {
-                thread->terminated = *term;
-                thread_append_node<graph::End>(ctx);
+                gctx.terminate(tid, *term);
+                if (gctx.record_graph)
+                    thread_append_node<graph::End>(ctx);
                 return *term;
             }
 
@@ -458,8 +493,9 @@ namespace gitmem
             first_statement = false;
         }
 
-        thread->terminated = TerminationStatus::completed;
-        thread_append_node<graph::End>(ctx);
+        gctx.terminate(tid, TerminationStatus::completed);
+        if (gctx.record_graph)
+            thread_append_node<graph::End>(ctx);
         return TerminationStatus::completed;
     }
 
@@ -492,40 +528,34 @@ namespace gitmem
         return any_progress ? ProgressStatus::progress : ProgressStatus::no_progress;
     }
 
-    /* Try to evaluate all threads until a sync point or termination point
+    /* Try to evaluate all runnable threads until a sync point or termination
+     * point. Threads that are spawned or woken during the round are tried in
+     * it if they come after the thread that spawned or woke them.
      */
     std::variant<ProgressStatus, TerminationStatus> run_threads_to_sync(GlobalContext& gctx)
     {
         verbose << "-----------------------" << std::endl;
-        bool all_completed = true;
         ProgressStatus any_progress = ProgressStatus::no_progress;
-        for (size_t i = 0; i < gctx.threads.size(); ++i)
+        auto it = gctx.runnable.begin();
+        while (it != gctx.runnable.end())
         {
+            ThreadID i = *it;
             verbose << "==== t" << i << " ====" << std::endl;
-            auto thread = gctx.threads[i];
-            if (!thread->terminated)
+            auto prog_or_term = run_single_thread_to_sync(gctx, i, gctx.threads[i]);
+            if (ProgressStatus* prog = std::get_if<ProgressStatus>(&prog_or_term))
             {
-                auto prog_or_term = run_single_thread_to_sync(gctx, i, thread);
-                if (ProgressStatus* prog = std::get_if<ProgressStatus>(&prog_or_term))
-                {
-                    any_progress |= *prog;
-                }
-                else
-                {
-                    // We could return termination status of any error here and stop
-                    // at the first error
-                    thread->terminated = std::get<TerminationStatus>(prog_or_term);
-                    any_progress |= ProgressStatus::progress;
-                }
-
-                all_completed &= thread->terminated.has_value();
-                // if a thread spawns a new thread, it will end up at the end so
-                // we will always include the new threads in the termination
-                // criteria
+                any_progress |= *prog;
             }
+            else
+            {
+                // We could return termination status of any error here and stop
+                // at the first error
+                any_progress |= ProgressStatus::progress;
+            }
+            it = gctx.runnable.upper_bound(i);
         }
 
-        if (all_completed) return TerminationStatus::completed;
+        if (gctx.runnable.empty() && gctx.no_parked == 0) return TerminationStatus::completed;
 
         return any_progress;
     }
@@ -541,6 +571,27 @@ namespace gitmem
         return true;
     }
 
+    /* Describe a cycle of the wait-for graph by what each of its threads
+     * waits for.
+     */
+    std::string describe_deadlock(const WaitCycle &cycle)
+    {
+        std::string description;
+        for (size_t i = 0; i < cycle.size(); ++i)
+        {
+            auto &[tid, lock] = cycle[i];
+            auto next = std::to_string(cycle[(i + 1) % cycle.size()].tid);
+            if (i > 0)
+                description += ", ";
+            description += "thread " + std::to_string(tid);
+            if (lock)
+                description += " waits for lock " + *lock + " held by thread " + next;
+            else
+                description += " joins thread " + next;
+        }
+        return description;
+    }
+
     /* Try to evaluate all threads until they have all terminated in some way
      * or we have reached a stuck configuration.
      */
@@ -553,6 +604,9 @@ namespace gitmem
 
         verbose << "----------- execution complete -----------" << std::endl;
 
+        if (gctx.deadlock)
+            verbose << "Deadlock: " << describe_deadlock(*gctx.deadlock) << std::endl;
+
         bool exception_detected = false;
         for (size_t i = 0; i < gctx.threads.size(); ++i)
         {
@@ -593,7 +647,8 @@ namespace gitmem
             else
             {
                 exception_detected = true;
-                thread_append_node<graph::End>(thread->ctx);
+                if (gctx.record_graph)
+                    thread_append_node<graph::End>(thread->ctx);
                 verbose << "Thread " << i << " is stuck" << std::endl;
             }
         }
@@ -603,7 +658,7 @@ namespace gitmem
 
     int interpret(const Node ast, const std::filesystem::path &output_path)
     {
-        GlobalContext gctx(ast);
+        GlobalContext gctx(bytecode::compile(ast));
         auto result = run_threads(gctx);
         gctx.print_execution_graph(output_path);
 
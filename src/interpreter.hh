@@ -1,9 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <set>
+#include <tuple>
 #include <trieste/trieste.h>
 #include "lang.hh"
 #include "graph.hh"
 #include "graphviz.hh"
+#include "bytecode.hh"
 
 namespace gitmem
 {
@@ -37,8 +42,194 @@ namespace gitmem
      * the current commit id for the variable, and the history of commited ids.
      */
 
+    /* Mix a hash value into a seed */
+    inline void hash_combine(size_t &seed, size_t value)
+    {
+        seed ^= value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
+    }
+
     using Commit = size_t;
-    using CommitHistory = std::vector<Commit>;
+    using ThreadID = size_t;
+    using VectorClock = std::vector<size_t>;
+
+    /* How pulling decides whether two histories of a variable conflict:
+     * by comparing the histories commit by commit, or by comparing the last
+     * commit of one history with the vector clock of the other. Both give
+     * the same results.
+     */
+    enum class RaceDetection
+    {
+        histories,
+        vector_clocks,
+    };
+
+    inline RaceDetection race_detection = RaceDetection::histories;
+
+    /* The history of commits of a global variable is an immutable chain from
+     * the newest commit back to the first. Histories that extend each other
+     * share their common tail, so copying a history or fast-forwarding it
+     * to a longer one copies a pointer, and two histories can be compared by
+     * walking back only to their common ancestor.
+     *
+     * With vector clock race detection, every commit is also an epoch: the
+     * k-th commit of a thread to the variable. A thread's own history only
+     * ever grows, so a history that contains a thread's k-th commit contains
+     * all its earlier ones, and the clock of a history, which counts the
+     * commits of each thread in it, decides in constant time whether it
+     * contains the last commit of another history.
+     *
+     * Links are released and reused by looking at their reference counts,
+     * which is only sound while every history sharing a link belongs to the
+     * same thread of the model checker. Histories that are handed to another
+     * thread are detached first.
+     */
+    class CommitHistory
+    {
+        struct Link
+        {
+            Commit commit;
+            size_t length;
+            std::shared_ptr<Link> prev;
+            ThreadID writer = 0;
+            std::shared_ptr<const VectorClock> clock; // Only for vector clock race detection
+        };
+
+        std::shared_ptr<Link> head;
+
+    public:
+        // The copies made of the links of a context being detached, so that
+        // histories that shared links keep sharing the copies
+        using LinkCopies = std::unordered_map<const Link *, std::shared_ptr<Link>>;
+
+        CommitHistory() = default;
+        CommitHistory(const CommitHistory &) = default;
+        CommitHistory(CommitHistory &&) = default;
+
+        CommitHistory &operator=(CommitHistory other)
+        {
+            // The old chain is released by the destructor of `other`
+            std::swap(head, other.head);
+            return *this;
+        }
+
+        ~CommitHistory()
+        {
+            // Release links that are not shared one at a time, so that long
+            // histories do not overflow the stack by releasing recursively
+            while (head && head.use_count() == 1)
+                head = std::move(head->prev);
+        }
+
+        size_t size() const { return head ? head->length : 0; }
+
+        /* A copy of the history that shares no links with this one. Links
+         * are copied from the oldest one that has not been copied yet, so
+         * that the copies are not released recursively either. */
+        CommitHistory detached(LinkCopies &copies) const
+        {
+            std::vector<const Link *> uncopied;
+            auto link = head.get();
+            while (link && !copies.contains(link))
+            {
+                uncopied.push_back(link);
+                link = link->prev.get();
+            }
+
+            CommitHistory copy;
+            if (link)
+                copy.head = copies.at(link);
+            for (auto it = uncopied.rbegin(); it != uncopied.rend(); ++it)
+            {
+                auto &l = **it;
+                copy.head = std::make_shared<Link>(l.commit, l.length, std::move(copy.head), l.writer, l.clock);
+                copies[*it] = copy.head;
+            }
+            return copy;
+        }
+
+        /* Whether both are copies of the same history, a constant-time
+         * sufficient condition for the histories to be equal */
+        bool same_as(const CommitHistory &other) const { return head == other.head; }
+
+        Commit back() const
+        {
+            assert(head);
+            return head->commit;
+        }
+
+        void push_back(Commit commit, ThreadID writer)
+        {
+            std::shared_ptr<const VectorClock> clock;
+            if (race_detection == RaceDetection::vector_clocks)
+            {
+                auto next = head ? std::make_shared<VectorClock>(*head->clock) : std::make_shared<VectorClock>();
+                if (next->size() <= writer)
+                    next->resize(writer + 1, 0);
+                ++(*next)[writer];
+                clock = std::move(next);
+            }
+            head = std::make_shared<Link>(commit, size() + 1, std::move(head), writer, std::move(clock));
+        }
+
+        /* Whether this history is a prefix of `other`, decided by whether the
+         * clock of `other` includes the epoch of the last commit of this
+         * history. Requires vector clock race detection. */
+        bool precedes(const CommitHistory &other) const
+        {
+            if (!head)
+                return true;
+            if (!other.head)
+                return false;
+
+            auto &clock = *other.head->clock;
+            auto epoch = (*head->clock)[head->writer];
+            return head->writer < clock.size() && clock[head->writer] >= epoch;
+        }
+
+        /* The first position at which two histories differ, as the pair of
+         * commits at that position, or nothing if one history is a prefix of
+         * the other. Walking stops at the first shared link.
+         */
+        std::optional<std::pair<Commit, Commit>> first_difference(const CommitHistory &other) const
+        {
+            auto l1 = head.get();
+            auto l2 = other.head.get();
+            if (!l1 || !l2)
+                return std::nullopt;
+
+            while (l1->length > l2->length)
+                l1 = l1->prev.get();
+            while (l2->length > l1->length)
+                l2 = l2->prev.get();
+
+            std::optional<std::pair<Commit, Commit>> difference;
+            while (l1 != l2)
+            {
+                if (l1->commit != l2->commit)
+                    difference = {l1->commit, l2->commit};
+                l1 = l1->prev.get();
+                l2 = l2->prev.get();
+            }
+            return difference;
+        }
+
+        /* Iteration visits commits from the newest to the first */
+        struct Iterator
+        {
+            const Link *link;
+
+            Commit operator*() const { return link->commit; }
+            Iterator &operator++()
+            {
+                link = link->prev.get();
+                return *this;
+            }
+            bool operator!=(const Iterator &other) const { return link != other.link; }
+        };
+
+        Iterator begin() const { return {head.get()}; }
+        Iterator end() const { return {nullptr}; }
+    };
 
     struct Global
     {
@@ -47,7 +238,160 @@ namespace gitmem
         CommitHistory history;
     };
 
-    using Globals = std::unordered_map<std::string, Global>;
+    /* The versioned global variables known to a synchronising object,
+     * indexed by the IDs the compiler interned the variables as. A bitmap
+     * records which variables are present, so that copying, committing,
+     * pulling and comparing scan contiguous memory instead of hashing names.
+     *
+     * Copies share their storage until one of them is modified, so handing
+     * the globals of a thread to a spawned thread or a lock copies a pointer,
+     * and only synchronising objects that go on to write pay for a copy.
+     * Like commit histories, globals are detached before they are handed to
+     * another thread of the model checker.
+     */
+    class Globals
+    {
+        struct Storage
+        {
+            std::vector<Global> slots;
+            std::vector<uint64_t> present;
+            size_t count = 0;
+        };
+
+        std::shared_ptr<Storage> storage;
+
+        const Storage &read() const
+        {
+            static const Storage empty;
+            return storage ? *storage : empty;
+        }
+
+        // The storage of this object only, copying it if it is shared
+        Storage &write()
+        {
+            if (!storage)
+                storage = std::make_shared<Storage>();
+            else if (storage.use_count() > 1)
+                storage = std::make_shared<Storage>(*storage);
+            return *storage;
+        }
+
+        // The first present variable from `var` on, found a word at a time
+        VarID next(VarID var) const
+        {
+            auto &s = read();
+            while (var < s.slots.size())
+            {
+                if (auto word = s.present[var / 64] >> (var % 64))
+                    return var + std::countr_zero(word);
+                var = (var / 64 + 1) * 64;
+            }
+            return s.slots.size();
+        }
+
+        struct Iterator
+        {
+            const Globals *globals;
+            VarID var;
+
+            std::pair<VarID, const Global &> operator*() const { return {var, globals->read().slots[var]}; }
+            Iterator &operator++()
+            {
+                var = globals->next(var + 1);
+                return *this;
+            }
+            bool operator!=(const Iterator &other) const { return var != other.var; }
+        };
+
+    public:
+        // The copies made of the storage and histories of a context being
+        // detached
+        struct Copies
+        {
+            std::unordered_map<const Storage *, std::shared_ptr<Storage>> storage;
+            CommitHistory::LinkCopies links;
+        };
+
+        /* A copy that shares neither its storage nor the links of its
+         * histories with this one */
+        Globals detached(Copies &copies) const
+        {
+            Globals copy;
+            if (!storage)
+                return copy;
+
+            // The histories are not copied with the storage, which would
+            // change the reference counts of links that are not ours
+            auto &detached = copies.storage[storage.get()];
+            if (!detached)
+            {
+                detached = std::make_shared<Storage>();
+                detached->present = storage->present;
+                detached->count = storage->count;
+                detached->slots.reserve(storage->slots.size());
+                for (auto &global : storage->slots)
+                    detached->slots.push_back({global.val, global.commit, global.history.detached(copies.links)});
+            }
+            copy.storage = detached;
+            return copy;
+        }
+
+        bool contains(VarID var) const
+        {
+            auto &s = read();
+            return var < s.slots.size() && (s.present[var / 64] >> (var % 64) & 1);
+        }
+
+        /* The variable `var` for modification, which is added if it is not
+         * present */
+        Global &operator[](VarID var)
+        {
+            auto &s = write();
+            if (var >= s.slots.size())
+            {
+                s.slots.resize(var + 1);
+                s.present.resize(var / 64 + 1);
+            }
+            auto bit = uint64_t(1) << (var % 64);
+            if (!(s.present[var / 64] & bit))
+            {
+                s.present[var / 64] |= bit;
+                ++s.count;
+            }
+            return s.slots[var];
+        }
+
+        const Global &at(VarID var) const
+        {
+            assert(contains(var));
+            return read().slots[var];
+        }
+
+        size_t size() const { return read().count; }
+
+        /* Whether both are unmodified copies of the same globals */
+        bool shares_storage(const Globals &other) const { return storage == other.storage; }
+
+        /* Whether both contain the same variables with the same values. The
+         * histories are not compared. */
+        bool same_values(const Globals &other) const
+        {
+            if (shares_storage(other))
+                return true;
+            if (size() != other.size())
+                return false;
+            for (auto [var, global] : *this)
+            {
+                if (!other.contains(var) || other.at(var).val != global.val)
+                    return false;
+            }
+            return true;
+        }
+
+        // Iteration visits the present variables in the order of their IDs
+        Iterator begin() const { return {this, next(0)}; }
+        Iterator end() const { return {this, read().slots.size()}; }
+    };
 
     enum class TerminationStatus
     {
@@ -58,13 +402,80 @@ namespace gitmem
         unassigned_variable_read_exception,
     };
 
-    using Locals = std::unordered_map<std::string, size_t>;
+    /* The registers of a thread, indexed by the slots that the compiler
+     * allocated for the registers of the thread's block, so that reading
+     * or writing a register is one indexed access. A bitmask records which
+     * registers have been assigned. Unassigned registers hold 0 so that
+     * two sets of registers are equal exactly when their vectors are.
+     */
+    class Locals
+    {
+        std::vector<size_t> vals;
+        std::vector<uint64_t> assigned;
+
+        struct Iterator
+        {
+            const Locals *locals;
+            size_t slot;
+
+            std::pair<size_t, size_t> operator*() const { return {slot, locals->vals[slot]}; }
+            Iterator &operator++()
+            {
+                slot = locals->next(slot + 1);
+                return *this;
+            }
+            bool operator!=(const Iterator &other) const { return slot != other.slot; }
+        };
+
+        // The first assigned slot from `slot` on, found a word at a time
+        size_t next(size_t slot) const
+        {
+            while (slot < vals.size())
+            {
+                if (auto word = assigned[slot / 64] >> (slot % 64))
+                    return slot + std::countr_zero(word);
+                slot = (slot / 64 + 1) * 64;
+            }
+            return vals.size();
+        }
+
+    public:
+        Locals() = default;
+        explicit Locals(size_t no_slots) : vals(no_slots, 0), assigned((no_slots + 63) / 64, 0) {}
+
+        bool contains(size_t slot) const
+        {
+            return assigned[slot / 64] >> (slot % 64) & 1;
+        }
+
+        size_t at(size_t slot) const
+        {
+            assert(contains(slot));
+            return vals[slot];
+        }
+
+        void set(size_t slot, size_t val)
+        {
+            assigned[slot / 64] |= uint64_t(1) << (slot % 64);
+            vals[slot] = val;
+        }
+
+        bool empty() const { return next(0) == vals.size(); }
+
+        bool operator==(const Locals &other) const = default;
+
+        // Iteration visits the assigned registers in the order of their slots
+        Iterator begin() const { return {this, next(0)}; }
+        Iterator end() const { return {this, vals.size()}; }
+    };
 
     struct ThreadContext
     {
         Locals locals;
         Globals globals;
         std::shared_ptr<graph::Node> tail;
+        ThreadID tid = 0;
+        std::vector<VarID> dirty = {}; // The globals with a pending commit
     };
 
     using ThreadStatus = std::optional<TerminationStatus>;
@@ -73,43 +484,75 @@ namespace gitmem
     {
         ThreadContext ctx;
         Node block;
+        const bytecode::Code *code = nullptr;
         size_t pc = 0;
         ThreadStatus terminated = std::nullopt;
 
+        // A thread that is blocked on a lock or a join is parked in a wait
+        // queue and not tried again until it is woken
+        bool parked = false;
+        std::vector<ThreadID> joiners; // The threads parked until this one completes
+
         bool operator==(const Thread &other) const
         {
             // Globals have a history that we don't care about, so we only
             // compare values
-            if (ctx.globals.size() != other.ctx.globals.size())
+            if (!ctx.globals.same_values(other.ctx.globals))
                 return false;
-            for (const auto &[var, global] : ctx.globals)
-            {
-                if (!other.ctx.globals.contains(var) ||
-                    ctx.globals.at(var).val != other.ctx.globals.at(var).val)
-                {
-                    return false;
-                }
-            }
             return ctx.locals == other.ctx.locals &&
                    block == other.block &&
                    pc == other.pc &&
                    terminated == other.terminated;
         }
-    };
 
-    using ThreadID = size_t;
+        /* A hash that agrees with operator==, i.e. ignores histories */
+        size_t hash() const
+        {
+            size_t globals_hash = 0;
+            for (auto [var, global] : ctx.globals)
+            {
+                hash_combine(globals_hash, var);
+                hash_combine(globals_hash, global.val);
+            }
+
+            size_t locals_hash = 0;
+            for (auto [slot, val] : ctx.locals)
+            {
+                hash_combine(locals_hash, slot);
+                hash_combine(locals_hash, val);
+            }
+
+            size_t seed = std::hash<const void *>{}(block.get());
+            hash_combine(seed, pc);
+            hash_combine(seed, terminated ? size_t(*terminated) + 1 : 0);
+            hash_combine(seed, globals_hash);
+            hash_combine(seed, locals_hash);
+            return seed;
+        }
+    };
 
     struct Lock
     {
         Globals globals;
         std::optional<ThreadID> owner = std::nullopt;
         std::shared_ptr<graph::Node> last;
+        std::vector<ThreadID> waiters; // The threads parked until the lock is released
     };
 
     using Threads = std::vector<std::shared_ptr<Thread>>;
 
     using Locks = std::unordered_map<std::string, struct Lock>;
 
+    /* A thread in a cycle of the wait-for graph, and the lock it waits for
+     * or nothing if it waits to join the next thread of the cycle */
+    struct Waiting
+    {
+        ThreadID tid;
+        std::optional<std::string> lock;
+    };
+
+    using WaitCycle = std::vector<Waiting>;
+
     template<typename T, typename...Args>
     std::shared_ptr<T> thread_append_node(ThreadContext& ctx, Args&&...args);
 
@@ -121,20 +564,127 @@ namespace gitmem
         Threads threads;
         Locks locks;
         NodeMap<size_t> cache;
+        std::shared_ptr<const bytecode::Program> program;
         std::shared_ptr<graph::Node> entry_node;
         std::unordered_map<Commit, std::shared_ptr<graph::Node>> commit_map;
         Commit uuid = 0;
-
-        GlobalContext(const Node &ast)
+        bool record_graph;
+
+        // The threads that have neither terminated nor are parked, which are
+        // the only ones that scheduling tries
+        std::set<ThreadID> runnable;
+        size_t no_parked = 0;
+
+        // The first cycle of parked threads that formed, whose threads can
+        // never make progress again
+        std::optional<WaitCycle> deadlock;
+
+        /* A context that does not record its execution graph runs without
+         * allocating graph nodes, but cannot be printed. The model checker
+         * explores without recording and re-executes the traces it reports.
+         */
+        GlobalContext(bytecode::ProgramPtr program, bool record_graph = true)
+            : program(std::move(program)), record_graph(record_graph)
         {
-            Node starting_block = ast / File / Block;
-            entry_node = std::make_shared<graph::Start>(0);
-            ThreadContext starting_ctx = {{}, {}, entry_node};
-            auto main_thread = std::make_shared<Thread>(starting_ctx, starting_block);
+            Node starting_block = this->program->entry();
+            if (record_graph)
+                entry_node = std::make_shared<graph::Start>(0);
+            auto &starting_code = this->program->code(starting_block);
+            ThreadContext starting_ctx = {Locals(starting_code.regs.size()), {}, entry_node};
+            auto main_thread = std::make_shared<Thread>(starting_ctx, starting_block, &starting_code);
 
             this->threads = {main_thread};
             this->locks = {};
             this->cache = {};
+            this->runnable = {0};
+        }
+
+        GlobalContext(GlobalContext &&) = default;
+        GlobalContext &operator=(GlobalContext &&) = default;
+
+    private:
+        // Contexts are only copied by snapshot(), which gives the copy
+        // threads of its own, so that every thread belongs to exactly one
+        // context and can be overwritten by it without checking for sharers
+        GlobalContext(const GlobalContext &) = default;
+
+    public:
+        /* Park a thread that cannot make progress in the wait queue of
+         * what it is blocked on. A parked thread is not parked twice.
+         */
+        void park(ThreadID tid, std::vector<ThreadID> &queue)
+        {
+            auto &thread = *threads[tid];
+            if (thread.parked)
+                return;
+            thread.parked = true;
+            queue.push_back(tid);
+            runnable.erase(tid);
+            no_parked++;
+
+            if (!deadlock)
+                deadlock = find_cycle(tid);
+        }
+
+        /* The thread that a parked thread waits for: the owner of the lock
+         * it waits for, or the thread it joins. A parked thread is woken
+         * whenever this could change.
+         */
+        ThreadID waits_for(ThreadID tid) const
+        {
+            auto &thread = *threads[tid];
+            auto &instr = thread.code->instrs[thread.pc];
+            if (instr.op == bytecode::Op::Lock)
+                return *locks.at(instr.name).owner;
+            return cache.at(instr.expr);
+        }
+
+        /* The wait-for graph has an edge from every parked thread, so a
+         * cycle can only form when a thread is parked, and it does if
+         * following the edges from that thread leads back to it.
+         */
+        std::optional<WaitCycle> find_cycle(ThreadID tid) const
+        {
+            WaitCycle cycle;
+            ThreadID current = tid;
+            do
+            {
+                // The path may run into a cycle that does not contain tid
+                auto &thread = *threads[current];
+                if (!thread.parked || cycle.size() == threads.size())
+                    return std::nullopt;
+
+                auto &instr = thread.code->instrs[thread.pc];
+                cycle.push_back({current, instr.op == bytecode::Op::Lock ? std::optional(instr.name) : std::nullopt});
+                current = waits_for(current);
+            } while (current != tid);
+            return cycle;
+        }
+
+        /* Make the threads in a wait queue runnable again. They may find
+         * themselves blocked again, in which case they are parked again.
+         */
+        void wake(std::vector<ThreadID> &queue)
+        {
+            for (auto tid : queue)
+            {
+                threads[tid]->parked = false;
+                runnable.insert(tid);
+            }
+            no_parked -= queue.size();
+            queue.clear();
+        }
+
+        /* Record that a thread terminated. Only threads that completed can
+         * be joined, so the joiners of a crashed thread stay parked.
+         */
+        void terminate(ThreadID tid, TerminationStatus status)
+        {
+            auto &thread = *threads[tid];
+            thread.terminated = status;
+            runnable.erase(tid);
+            if (status == TerminationStatus::completed)
+                wake(thread.joiners);
         }
 
         bool operator==(const GlobalContext &other) const
@@ -142,15 +692,55 @@ namespace gitmem
             if (threads.size() != other.threads.size() || locks.size() != other.locks.size())
                 return false;
 
-            // Threads may have been spawned in a different order, so we
-            // find the thread with the same block in the other context
-            for (auto &thread : threads)
+            // Threads may have been spawned in a different order, so they
+            // are compared as multisets, as the hash combines them. Equal
+            // threads have the same block and hash, so both sides are sorted
+            // by these and only threads with the same key are matched, one
+            // to one.
+            struct Keyed
             {
-                auto it = std::find_if(other.threads.begin(), other.threads.end(),
-                                       [&thread](auto &t)
-                                       { return t->block == thread->block; });
-                if (it == other.threads.end() || !(*thread == **it))
-                    return false;
+                const void *block;
+                size_t hash;
+                const Thread *thread;
+
+                bool same_key(const Keyed &other) const { return block == other.block && hash == other.hash; }
+            };
+            auto by_key = [](const Threads &threads)
+            {
+                std::vector<Keyed> keyed;
+                keyed.reserve(threads.size());
+                for (const auto &thread : threads)
+                    keyed.push_back({thread->block.get(), thread->hash(), thread.get()});
+                std::sort(keyed.begin(), keyed.end(),
+                          [](const Keyed &k1, const Keyed &k2)
+                          { return std::tie(k1.block, k1.hash) < std::tie(k2.block, k2.hash); });
+                return keyed;
+            };
+
+            auto mine = by_key(threads);
+            auto theirs = by_key(other.threads);
+            for (size_t begin = 0, end; begin < mine.size(); begin = end)
+            {
+                end = begin + 1;
+                while (end < mine.size() && mine[end].same_key(mine[begin]))
+                    ++end;
+
+                for (size_t i = begin; i < end; ++i)
+                {
+                    if (!theirs[i].same_key(mine[begin]))
+                        return false;
+                }
+
+                std::vector<bool> matched(end - begin, false);
+                for (size_t i = begin; i < end; ++i)
+                {
+                    size_t j = 0;
+                    while (j < matched.size() && (matched[j] || !(*mine[i].thread == *theirs[begin + j].thread)))
+                        ++j;
+                    if (j == matched.size())
+                        return false;
+                    matched[j] = true;
+                }
             }
 
             for (auto &[name, lock] : locks)
@@ -164,8 +754,109 @@ namespace gitmem
             return true;
         }
 
+        /* A hash that agrees with operator==. Threads are combined in an
+         * order-independent way since they may have been spawned in a
+         * different order.
+         */
+        size_t hash() const
+        {
+            size_t threads_hash = 0;
+            for (const auto &thread : threads)
+                threads_hash += thread->hash();
+
+            size_t locks_hash = 0;
+            for (const auto &[name, lock] : locks)
+            {
+                size_t entry = std::hash<std::string>{}(name);
+                hash_combine(entry, lock.owner ? *lock.owner + 1 : 0);
+                locks_hash += entry;
+            }
+
+            size_t seed = threads.size();
+            hash_combine(seed, threads_hash);
+            hash_combine(seed, locks_hash);
+            return seed;
+        }
+
+        struct Hash
+        {
+            size_t operator()(const GlobalContext &gctx) const { return gctx.hash(); }
+        };
+
+        /* Copy the context so that the copy can be run independently of this
+         * one. Threads are copied but the execution graph built so far is
+         * shared, so a snapshot is only valid until it is restored.
+         */
+        GlobalContext snapshot() const
+        {
+            GlobalContext copy = *this;
+            for (auto &thread : copy.threads)
+                thread = std::make_shared<Thread>(*thread);
+            return copy;
+        }
+
+        /* A snapshot that shares no globals or commit histories with this
+         * context, which can be handed to another thread of the model
+         * checker. Sharing within the snapshot is kept. */
+        GlobalContext detached() const
+        {
+            GlobalContext copy = snapshot();
+            Globals::Copies copies;
+            for (auto &thread : copy.threads)
+                thread->ctx.globals = thread->ctx.globals.detached(copies);
+            for (auto &[name, lock] : copy.locks)
+                lock.globals = lock.globals.detached(copies);
+            return copy;
+        }
+
+        /* Make this context a snapshot of `other`, reusing the allocations
+         * of this context: its threads are overwritten in place, and the
+         * lock and cache tables are assigned element-wise, which keeps their
+         * buckets.
+         */
+        void assign(const GlobalContext &other)
+        {
+            threads.resize(other.threads.size());
+            for (size_t i = 0; i < threads.size(); ++i)
+            {
+                if (threads[i])
+                    *threads[i] = *other.threads[i];
+                else
+                    threads[i] = std::make_shared<Thread>(*other.threads[i]);
+            }
+            locks = other.locks;
+            cache = other.cache;
+            program = other.program;
+            entry_node = other.entry_node;
+            commit_map = other.commit_map;
+            uuid = other.uuid;
+            record_graph = other.record_graph;
+            runnable = other.runnable;
+            no_parked = other.no_parked;
+            deadlock = other.deadlock;
+        }
+
+        /* Roll back to a snapshot taken earlier in the same execution. Graph
+         * nodes appended after the snapshot was taken are cut off from the
+         * threads' tails. Restores happen on every backtrack and every
+         * sampled schedule, so they reuse the allocations of this context.
+         */
+        void restore(const GlobalContext &snapshot)
+        {
+            assign(snapshot);
+            if (record_graph)
+            {
+                for (auto &thread : threads)
+                    thread->ctx.tail->next.reset();
+            }
+        }
+
+        const std::string &var_name(VarID var) const { return program->vars[var]; }
+
         void print_execution_graph(const std::filesystem::path &output_path) const
         {
+            assert(record_graph);
+
             // Loop over the threads and add pending nodes to running threads
             // to indicate a threads next step
             for (const auto& t: threads)
@@ -180,7 +871,7 @@ namespace gitmem
                 thread_append_node<graph::Pending>(t->ctx, std::string(stmt->location().view()));
             }
 
-            graph::GraphvizPrinter gv(output_path);
+            graph::GraphvizPrinter gv(output_path, program->vars);
             gv.visit(entry_node.get());
         }
     };
@@ -200,13 +891,37 @@ namespace gitmem
 
     inline void operator|=(ProgressStatus &p1, const ProgressStatus &p2) { p1 = (p1 || p2); }
 
+    /* Options controlling the exploration of the model checker */
+    struct ExploreOptions
+    {
+        bool print_stats = false; // Report the number of explored states
+        bool partial_order_reduction = false; // Only explore one interleaving of commuting steps
+        bool sleep_sets = false; // Do not take steps that an explored sibling subtree covers
+        size_t jobs = 1; // Number of worker threads exploring in parallel
+        bool stateful = false; // Do not explore states that have been reached before
+        size_t visited_limit_mb = 1024; // Memory for remembering visited states
+        bool symmetry = false; // Only schedule one of several interchangeable threads
+        std::optional<size_t> max_preemptions; // Bound on switches away from a runnable thread
+        std::optional<size_t> max_depth; // Bound on the number of steps in a trace
+        std::optional<size_t> samples; // Run this many random schedules instead of exploring
+        uint64_t seed = 0; // Seed of the first random schedule
+        size_t pct_depth = 3; // Number of ordering constraints a sampled bug may need
+        bool first_error = false; // Stop at the first trace that crashes or deadlocks
+        bool shortest = false; // Report a shortest trace for each kind of failure
+        std::filesystem::path checkpoint; // File that the exploration is periodically saved to
+        size_t checkpoint_interval = 60; // Seconds between two checkpoints
+        bool resume = false; // Continue the exploration saved in the checkpoint
+    };
+
     // Entry functions
     int interpret(const Node, const std::filesystem::path &output_file);
     int interpret_interactive(const Node, const std::filesystem::path &output_file);
-    int model_check(const Node, const std::filesystem::path &output_file);
+    int model_check(const Node, const std::filesystem::path &output_file, const ExploreOptions &options = {});
+    int quick_check(const Node);
 
     // Internal functions
     int run_threads(GlobalContext &);
+    std::string describe_deadlock(const WaitCycle &);
 
     std::variant<ProgressStatus, TerminationStatus>
     progress_thread(GlobalContext &, const ThreadID, std::shared_ptr<Thread>);
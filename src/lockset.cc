@@ -0,0 +1,274 @@
+#include <set>
+
+#include "interpreter.hh"
+
+namespace gitmem
+{
+    using namespace trieste;
+
+    /* A lockset analysis that looks for candidate data races without running
+     * the program. Programs only jump forward, so every spawn expression
+     * starts at most one thread and the threads of a program are known
+     * statically. Two writes to the same global race unless they are in the
+     * same thread, a common lock is held at both of them, or one happens
+     * before the other through spawns and joins. Reads never race, since
+     * races are conflicting commits. The analysis reports every race that
+     * exploration can find, and more: it does not know which branches are
+     * taken, and it ignores the ordering that locks establish between
+     * critical sections.
+     */
+    namespace lockset
+    {
+        using Locks = std::set<std::string>;
+
+        struct Write
+        {
+            size_t tid;
+            size_t pc;
+            VarID var;
+            Locks locks;               // The locks held on every path to the write
+            std::vector<size_t> after; // The first pc of each thread that the write happens before
+        };
+
+        struct StaticThread
+        {
+            Node block;
+            const bytecode::Code *code;
+            std::vector<std::pair<size_t, size_t>> spawns;  // The pc of each spawn and the thread it starts
+            std::vector<std::pair<size_t, size_t>> joiners; // The thread and pc of each join that always waits for this thread
+        };
+
+        struct Analysis
+        {
+            std::vector<StaticThread> threads;
+            std::unordered_map<const bytecode::ExprInstr *, size_t> spawned; // The thread started by each spawn
+            std::vector<Write> writes;
+        };
+
+        size_t collect_threads(Analysis &analysis, const Node &block, const bytecode::Code &code)
+        {
+            size_t tid = analysis.threads.size();
+            analysis.threads.push_back({block, &code, {}, {}});
+            for (size_t pc = 0; pc < code.instrs.size(); ++pc)
+            {
+                auto &instr = code.instrs[pc];
+                for (auto i = instr.expr_begin; i < instr.expr_end; ++i)
+                {
+                    auto &e = code.exprs[i];
+                    if (e.op != bytecode::ExprOp::Spawn)
+                        continue;
+                    auto child = collect_threads(analysis, e.block, *e.code);
+                    analysis.threads[tid].spawns.push_back({pc, child});
+                    analysis.spawned[&e] = child;
+                }
+            }
+            return tid;
+        }
+
+        /* Whether every path through the code executes the statement at
+         * `pc`, i.e. no branch jumps over it.
+         */
+        std::vector<bool> always_executed(const bytecode::Code &code)
+        {
+            auto n = code.instrs.size();
+            std::vector<int> skipping(n + 1, 0);
+            for (size_t pc = 0; pc < n; ++pc)
+            {
+                auto &instr = code.instrs[pc];
+                if (instr.op != bytecode::Op::Jump && instr.op != bytecode::Op::Cond)
+                    continue;
+                skipping[pc + 1]++;
+                skipping[std::min(pc + instr.delta, n)]--;
+            }
+
+            std::vector<bool> always(n);
+            int depth = 0;
+            for (size_t pc = 0; pc < n; ++pc)
+            {
+                depth += skipping[pc];
+                always[pc] = depth == 0;
+            }
+            return always;
+        }
+
+        /* The locks that are held on every path to each statement. Jumps
+         * only go forward, so one pass in program order sees every
+         * predecessor of a statement before the statement itself.
+         */
+        std::vector<std::optional<Locks>> held_locks(const bytecode::Code &code)
+        {
+            auto n = code.instrs.size();
+            std::vector<std::optional<Locks>> held(n + 1);
+            held[0] = Locks{};
+
+            auto flow = [&held](size_t target, const Locks &locks)
+            {
+                if (!held[target])
+                {
+                    held[target] = locks;
+                    return;
+                }
+                std::erase_if(*held[target], [&locks](const std::string &lock)
+                              { return !locks.contains(lock); });
+            };
+
+            for (size_t pc = 0; pc < n; ++pc)
+            {
+                if (!held[pc])
+                    continue;
+
+                auto &instr = code.instrs[pc];
+                auto locks = *held[pc];
+                if (instr.op == bytecode::Op::Lock)
+                    locks.insert(instr.name);
+                else if (instr.op == bytecode::Op::Unlock)
+                    locks.erase(instr.name);
+
+                if (instr.op != bytecode::Op::Jump)
+                    flow(pc + 1, locks);
+                if (instr.op == bytecode::Op::Jump || instr.op == bytecode::Op::Cond)
+                    flow(std::min(pc + instr.delta, n), locks);
+            }
+            return held;
+        }
+
+        /* Record the writes of a thread and the joins that are known to wait
+         * for a particular thread. A join waits for a known thread if it
+         * joins a spawn expression directly, or a register that is only ever
+         * assigned a spawn expression.
+         */
+        void analyse_thread(Analysis &analysis, size_t tid)
+        {
+            auto &code = *analysis.threads[tid].code;
+            auto always = always_executed(code);
+            auto held = held_locks(code);
+
+            auto single_spawn = [&](const bytecode::Instr &instr) -> const bytecode::ExprInstr *
+            {
+                if (instr.expr_end - instr.expr_begin != 1 || code.exprs[instr.expr_begin].op != bytecode::ExprOp::Spawn)
+                    return nullptr;
+                return &code.exprs[instr.expr_begin];
+            };
+
+            std::vector<size_t> assignments(code.regs.size(), 0);
+            std::vector<std::optional<size_t>> reg_threads(code.regs.size());
+            for (auto &instr : code.instrs)
+            {
+                if (instr.op != bytecode::Op::AssignReg)
+                    continue;
+                assignments[instr.slot]++;
+                if (auto spawn = single_spawn(instr))
+                    reg_threads[instr.slot] = analysis.spawned.at(spawn);
+            }
+
+            for (size_t pc = 0; pc < code.instrs.size(); ++pc)
+            {
+                auto &instr = code.instrs[pc];
+                if (instr.op == bytecode::Op::AssignVar && held[pc])
+                {
+                    analysis.writes.push_back({tid, pc, instr.var, *held[pc], {}});
+                }
+                else if (instr.op == bytecode::Op::Join && always[pc])
+                {
+                    std::optional<size_t> joinee;
+                    auto &e = code.exprs[instr.expr_begin];
+                    if (auto spawn = single_spawn(instr))
+                        joinee = analysis.spawned.at(spawn);
+                    else if (instr.expr_end - instr.expr_begin == 1 && e.op == bytecode::ExprOp::Reg &&
+                             assignments[e.slot] == 1)
+                        joinee = reg_threads[e.slot];
+
+                    if (joinee)
+                        analysis.threads[*joinee].joiners.push_back({tid, pc});
+                }
+            }
+        }
+
+        /* Mark the statements of thread `tid` from `pc` on, and everything
+         * that they happen before, as coming after a write.
+         */
+        void happens_before(const Analysis &analysis, size_t tid, size_t pc, std::vector<size_t> &after)
+        {
+            if (after[tid] <= pc)
+                return;
+            after[tid] = pc;
+
+            auto &thread = analysis.threads[tid];
+            for (auto [spawn_pc, child] : thread.spawns)
+            {
+                if (spawn_pc >= pc)
+                    happens_before(analysis, child, 0, after);
+            }
+
+            // A thread can only be joined once it has terminated
+            for (auto [joiner, join_pc] : thread.joiners)
+                happens_before(analysis, joiner, join_pc + 1, after);
+        }
+
+        bool ordered(const Write &w1, const Write &w2)
+        {
+            return w1.after[w2.tid] <= w2.pc || w2.after[w1.tid] <= w1.pc;
+        }
+
+        bool share_lock(const Write &w1, const Write &w2)
+        {
+            return std::any_of(w1.locks.begin(), w1.locks.end(),
+                               [&w2](const std::string &lock)
+                               { return w2.locks.contains(lock); });
+        }
+
+        std::string describe(const Analysis &analysis, const Write &write)
+        {
+            auto stmt = analysis.threads[write.tid].block->at(write.pc);
+            auto line = stmt->location().linecol().first + 1;
+            return "'" + std::string(stmt->location().view()) + "' (line " + std::to_string(line) + ")";
+        }
+    }
+
+    /* Report the candidate data races of a program found by the lockset
+     * analysis. Returns 0 if there are none, in which case exploring the
+     * program will not find a data race either.
+     */
+    int quick_check(const Node ast)
+    {
+        using namespace lockset;
+
+        auto program = bytecode::compile(ast);
+        Analysis analysis;
+        Node main_block = ast / File / Block;
+        collect_threads(analysis, main_block, program->code(main_block));
+        for (size_t tid = 0; tid < analysis.threads.size(); ++tid)
+            analyse_thread(analysis, tid);
+
+        for (auto &write : analysis.writes)
+        {
+            write.after.assign(analysis.threads.size(), SIZE_MAX);
+            happens_before(analysis, write.tid, write.pc + 1, write.after);
+        }
+
+        std::vector<std::string> races;
+        for (size_t i = 0; i < analysis.writes.size(); ++i)
+        {
+            auto &w1 = analysis.writes[i];
+            for (size_t j = i + 1; j < analysis.writes.size(); ++j)
+            {
+                auto &w2 = analysis.writes[j];
+                if (w1.var != w2.var || w1.tid == w2.tid || share_lock(w1, w2) || ordered(w1, w2))
+                    continue;
+
+                races.push_back(program->vars[w1.var] + ": " + describe(analysis, w1) + " and " + describe(analysis, w2));
+            }
+        }
+
+        if (races.empty())
+        {
+            std::cout << "No candidate data races found" << std::endl;
+            return 0;
+        }
+
+        std::cout << "Found " << races.size() << " candidate data race(s):" << std::endl;
+        for (const auto &race : races)
+            std::cout << race << std::endl;
+        return 1;
+    }
+}
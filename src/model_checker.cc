@@ -1,47 +1,249 @@
-#include "interpreter.hh"
+#include <chrono>
+#include <set>
+
+#include "model_checker.hh"
 
 namespace gitmem
 {
     using namespace trieste;
 
     /**
-     * A TraceNode represents a point in the space of possible schedulings. A
-     * path in a tree of TraceNodes represents a scheduling, with the thread ID
-     * of each node being the thread that was scheduled at that point. When
-     * there are no more children to explore, or when one thread has crashed,
-     * the TraceNode is marked as complete so that the next run will not explore
-     * it again.
-     *
+     * The synchronising operation that the next step of a thread starts with,
+     * or nothing if the thread has terminated.
      */
-    struct TraceNode
+    std::optional<SyncEvent> next_sync_event(const GlobalContext &gctx, const ThreadID tid)
     {
-        size_t tid_;
-        bool complete;
-        std::vector<std::shared_ptr<TraceNode>> children;
+        auto &thread = gctx.threads[tid];
+        if (thread->terminated)
+            return std::nullopt;
 
-        TraceNode(const size_t tid) : tid_(tid), complete(false) {}
+        auto &code = *thread->code;
+        auto &instr = code.instrs[thread->pc];
+        if (instr.op == bytecode::Op::Lock)
+            return SyncEvent{tid, SyncKind::lock, instr.name, std::nullopt, instr.step_spawns};
+        if (instr.op == bytecode::Op::Unlock)
+            return SyncEvent{tid, SyncKind::unlock, instr.name, std::nullopt, instr.step_spawns};
 
-        std::shared_ptr<TraceNode> extend(ThreadID tid)
+        assert(instr.op == bytecode::Op::Join);
+        std::optional<ThreadID> joinee = std::nullopt;
+        if (auto it = gctx.cache.find(instr.expr); it != gctx.cache.end())
         {
-            children.push_back(std::make_shared<TraceNode>(tid));
-            return children.back();
+            joinee = it->second;
         }
+        else if (instr.expr_end - instr.expr_begin == 1)
+        {
+            auto &e = code.exprs[instr.expr_begin];
+            if (e.op == bytecode::ExprOp::Const)
+            {
+                joinee = e.value;
+            }
+            else if (e.op == bytecode::ExprOp::Reg)
+            {
+                if (thread->ctx.locals.contains(e.slot))
+                    joinee = thread->ctx.locals.at(e.slot);
+            }
+        }
+        return SyncEvent{tid, SyncKind::join, "", joinee, instr.step_spawns};
+    }
 
-        bool is_leaf() const
+    /**
+     * The thread joined by the step a thread took from the state `before`,
+     * which has been evaluated in the state `after`.
+     */
+    ThreadID join_target(const GlobalContext &before, const GlobalContext &after, const ThreadID tid)
+    {
+        auto &thread = before.threads[tid];
+        return after.cache.at(thread->code->instrs[thread->pc].expr);
+    }
+
+    /**
+     * Whether a thread can take a step. Joins on threads that are not known
+     * yet are assumed to be enabled.
+     */
+    bool is_enabled(const GlobalContext &gctx, const SyncEvent &event)
+    {
+        switch (event.kind)
         {
-            return children.empty();
+        case SyncKind::lock:
+        {
+            auto it = gctx.locks.find(event.lock);
+            return it == gctx.locks.end() || !it->second.owner;
         }
-    };
+        case SyncKind::unlock:
+            return true;
+        case SyncKind::join:
+            if (!event.joinee)
+                return true;
+            if (*event.joinee >= gctx.threads.size())
+                return false;
+            auto &joinee = gctx.threads[*event.joinee];
+            return joinee->terminated && *joinee->terminated == TerminationStatus::completed;
+        }
+        return true;
+    }
+
+    /**
+     * Whether a thread can take another step, so that scheduling any other
+     * thread instead preempts it
+     */
+    bool is_runnable(const GlobalContext &gctx, ThreadID tid)
+    {
+        auto event = next_sync_event(gctx, tid);
+        return event && is_enabled(gctx, *event);
+    }
+
+    /**
+     * Two steps of different threads are dependent if they operate on the
+     * same lock, or if one joins the thread taking the other. Steps of the
+     * same thread are always dependent, and a join on an unknown thread is
+     * conservatively dependent with everything. Two steps that both spawn
+     * are dependent, since their order decides the IDs of the spawned
+     * threads, which the program may use as data. The relation is
+     * symmetric, also when both steps are joins.
+     */
+    bool is_dependent(const SyncEvent &e1, const SyncEvent &e2)
+    {
+        if (e1.tid == e2.tid || (e1.spawns && e2.spawns))
+            return true;
+
+        auto joins = [](const SyncEvent &e, const SyncEvent &other)
+        { return e.kind == SyncKind::join && (!e.joinee || *e.joinee == other.tid); };
+        if (e1.kind == SyncKind::join || e2.kind == SyncKind::join)
+            return joins(e1, e2) || joins(e2, e1);
+        return e1.lock == e2.lock;
+    }
+
+    /**
+     * A thread can only be joined after it has terminated, so a join is never
+     * enabled at the same time as a step of the thread it joins.
+     */
+    bool may_be_coenabled(const SyncEvent &e1, const SyncEvent &e2)
+    {
+        return !(e1.kind == SyncKind::join && e1.joinee == e2.tid) &&
+               !(e2.kind == SyncKind::join && e2.joinee == e1.tid);
+    }
+
+    size_t clock_at(const VectorClock &clock, const ThreadID tid)
+    {
+        return tid < clock.size() ? clock[tid] : 0;
+    }
+
+    void clock_join(VectorClock &clock, const VectorClock &other)
+    {
+        if (clock.size() < other.size())
+            clock.resize(other.size(), 0);
+        for (size_t i = 0; i < other.size(); ++i)
+            clock[i] = std::max(clock[i], other[i]);
+    }
+
+    /**
+     * The happens-before clock of the last step of a thread on the path, or
+     * of the step that spawned it if it has not taken a step yet. The clock
+     * maps each thread to the depth of its last step that happens before.
+     */
+    VectorClock thread_clock(const std::vector<Branch> &path, const ThreadID tid)
+    {
+        for (size_t d = path.size() - 1; d > 0; --d)
+        {
+            auto &node = path[d].node;
+            if (node.tid_ == tid || path[d - 1].node.no_threads <= tid)
+                return node.clock;
+        }
+        return {};
+    }
+
+    /**
+     * Compute the happens-before clock of a step taken from the last node of
+     * the path.
+     */
+    VectorClock step_clock(const std::vector<Branch> &path, const SyncEvent &event)
+    {
+        VectorClock clock = thread_clock(path, event.tid);
+        for (size_t d = 1; d < path.size(); ++d)
+        {
+            auto &node = path[d].node;
+            if (is_dependent(*node.event, event))
+                clock_join(clock, node.clock);
+        }
+        if (clock.size() <= event.tid)
+            clock.resize(event.tid + 1, 0);
+        clock[event.tid] = path.size();
+        return clock;
+    }
+
+    /**
+     * Dynamic partial-order reduction (Flanagan and Godefroid, 2005). For the
+     * next step of every thread in the state at the end of the path, find the
+     * last step on the path that it races with, i.e. that is dependent, may
+     * be co-enabled and does not happen before it. Reversing the race must be
+     * explored, so a thread that leads to it is added to the backtrack set of
+     * the state before the racing step.
+     */
+    void add_backtrack_points(const GlobalContext &gctx, std::vector<Branch> &path)
+    {
+        for (ThreadID tid = 0; tid < gctx.threads.size(); ++tid)
+        {
+            auto event = next_sync_event(gctx, tid);
+            if (!event)
+                continue;
+
+            auto clock = thread_clock(path, tid);
+            for (size_t d = path.size() - 1; d > 0; --d)
+            {
+                auto &step = *path[d].node.event;
+                if (step.tid == tid || !is_dependent(step, *event) ||
+                    !may_be_coenabled(step, *event) || clock_at(clock, step.tid) >= d)
+                    continue;
+
+                // Prefer scheduling the thread itself before the racing step,
+                // otherwise a thread with a later step that happens before it
+                auto &pre = path[d - 1].node;
+                auto &enabled = pre.enabled;
+                auto it = std::find(enabled.begin(), enabled.end(), tid);
+                if (it == enabled.end())
+                    it = std::find_if(enabled.begin(), enabled.end(),
+                                      [&clock, d](ThreadID t)
+                                      { return clock_at(clock, t) > d; });
+
+                if (it != enabled.end())
+                    pre.backtrack.insert(*it);
+                else
+                    pre.backtrack.insert(enabled.begin(), enabled.end());
+
+                verbose << "Race between step " << d << " and thread " << tid << std::endl;
+                break;
+            }
+        }
+    }
+
+    /**
+     * Record the threads enabled in the state of a newly reached node.
+     */
+    void record_enabled(const GlobalContext &gctx, TraceNode &node)
+    {
+        node.no_threads = gctx.threads.size();
+        for (ThreadID tid = 0; tid < gctx.threads.size(); ++tid)
+        {
+            auto event = next_sync_event(gctx, tid);
+            if (event && is_enabled(gctx, *event))
+                node.enabled.push_back(tid);
+        }
+    }
 
     /**
      * Print the traces of the program, one trace per line. Each trace is a
      * sequence of thread IDs that were scheduled in that order.
      */
     template <typename S>
-    void print_traces(S &stream, const std::vector<std::vector<ThreadID>> &traces)
+    void print_traces(S &stream, const std::vector<std::vector<ThreadID>> &traces, const std::vector<uint64_t> &seeds = {})
     {
-        for (const auto &trace : traces)
+        for (size_t i = 0; i < traces.size(); ++i)
         {
+            const auto &trace = traces[i];
+            if (i < seeds.size())
+            {
+                stream << "(seed " << seeds[i] << ") ";
+            }
             for (const auto &tid : trace)
             {
                 stream << tid << " ";
@@ -60,155 +262,721 @@ namespace gitmem
         return parent / (name + "_" + std::to_string(idx) + ext);
     }
 
+    /** Re-execute a trace from the start of the program. The exploration
+     * does not record execution graphs, so the graphs of reported traces are
+     * rebuilt this way before they are printed. */
+    GlobalContext replay_trace(const bytecode::ProgramPtr &program, const std::vector<ThreadID> &trace, bool record_graph)
+    {
+        GlobalContext gctx(program, record_graph);
+        for (const auto &tid : trace)
+        {
+            verbose << "==== Thread " << tid << " (replay) ====" << std::endl;
+            progress_thread(gctx, tid, gctx.threads[tid]);
+        }
+        return gctx;
+    }
+
+    void StateKey::add(size_t value)
+    {
+        bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void StateKey::add(const std::string &name)
+    {
+        add(name.size());
+        bytes.append(name);
+    }
+
+    void StateKey::add(const Globals &globals)
+    {
+        add(globals.size());
+        for (auto [var, global] : globals)
+        {
+            add(var);
+            add(global.val);
+            add(global.commit.has_value());
+            if (global.commit)
+                add_commit(*global.commit);
+            add(global.history.size());
+            for (auto commit : global.history)
+                add_commit(commit);
+        }
+    }
+
+    void StateKey::add_commit(Commit commit)
+    {
+        add(renaming.try_emplace(commit, renaming.size()).first->second);
+    }
+
     /**
-     * Explore all possible execution paths of the program, printing one trace
-     * for each distinct final state that led to an error.
+     * Serialise everything about a global context that affects its future:
+     * threads, locks, pending commits and commit histories.
      */
-    int model_check(const Node ast, const std::filesystem::path &output_path)
+    std::string canonical_state(const GlobalContext &gctx)
     {
-        GlobalContext gctx(ast);
+        StateKey key;
 
-        auto final_contexts = std::vector<GlobalContext>{};
-        auto failing_contexts = std::vector<GlobalContext>{};
-        auto deadlocked_contexts = std::vector<GlobalContext>{};
+        key.add(gctx.threads.size());
+        for (const auto &thread : gctx.threads)
+        {
+            key.add(size_t(thread->block.get()));
+            key.add(thread->pc);
+            key.add(thread->terminated ? size_t(*thread->terminated) + 1 : 0);
 
-        auto final_traces = std::vector<std::vector<size_t>>{};
-        auto failing_traces = std::vector<std::vector<size_t>>{};
-        auto deadlocked_traces = std::vector<std::vector<size_t>>{};
+            // Threads with the same block have the same register slots
+            for (auto [slot, val] : thread->ctx.locals)
+            {
+                key.add(slot + 1);
+                key.add(val);
+            }
+            key.add(0);
 
-        const auto root = std::make_shared<TraceNode>(0);
-        auto cursor = root;
-        auto current_trace = std::vector<size_t>{0}; // Start with the main thread
-        verbose << "==== Thread " << cursor->tid_ << " ====" << std::endl;
-        progress_thread(gctx, cursor->tid_, gctx.threads[cursor->tid_]);
+            key.add(thread->ctx.globals);
+        }
+
+        std::vector<const std::pair<const std::string, struct Lock> *> locks;
+        for (const auto &entry : gctx.locks)
+            locks.push_back(&entry);
+        std::sort(locks.begin(), locks.end(),
+                  [](auto *l1, auto *l2)
+                  { return l1->first < l2->first; });
+
+        key.add(locks.size());
+        for (const auto *entry : locks)
+        {
+            const auto &[name, lock] = *entry;
+            key.add(name);
+            key.add(lock.owner ? *lock.owner + 1 : 0);
+            key.add(lock.globals);
+        }
+
+        std::vector<std::pair<size_t, size_t>> cache;
+        for (const auto &[expr, val] : gctx.cache)
+            cache.emplace_back(size_t(expr.get()), val);
+        std::sort(cache.begin(), cache.end());
+        key.add(cache.size());
+        for (const auto &[expr, val] : cache)
+        {
+            key.add(expr);
+            key.add(val);
+        }
+
+        return std::move(key.bytes);
+    }
 
-        while (!root->complete)
+    /**
+     * The key of a state in a stateful search. With bounds, a state reached
+     * with less of the budget left has a smaller future, so the budget is
+     * part of the key.
+     */
+    std::string bounded_state(const GlobalContext &gctx, const ExploreOptions &options,
+                              const std::vector<ThreadID> &trace, size_t preemptions)
+    {
+        StateKey key;
+        key.bytes = canonical_state(gctx);
+        if (options.max_preemptions)
+        {
+            key.add(preemptions);
+            key.add(trace.back());
+        }
+        if (options.max_depth)
         {
-            while (!cursor->children.empty() && !cursor->children.back()->complete)
+            key.add(trace.size());
+        }
+        return std::move(key.bytes);
+    }
+
+    /**
+     * The states seen by a stateful search. Once the memory limit is reached
+     * no more states are added, but the states already seen are still used
+     * for pruning.
+     */
+    class VisitedStates
+    {
+        std::unordered_set<std::string> states;
+        size_t bytes = 0;
+        size_t limit;
+        bool full = false;
+
+    public:
+        VisitedStates(size_t limit) : limit(limit) {}
+
+        // Returns true if the state has been visited before
+        bool visit(std::string &&state)
+        {
+            if (states.contains(state))
+                return true;
+
+            // Account for the string, its heap buffer and the table node
+            size_t size = sizeof(std::string) + state.capacity() + 2 * sizeof(void *);
+            if (bytes + size <= limit)
             {
-                // We have a child that is not complete, we can extend that trace
-                cursor = cursor->children.back();
-                current_trace.push_back(cursor->tid_);
-                verbose << "==== Thread " << cursor->tid_ << " (replay) ====" << std::endl;
-                progress_thread(gctx, cursor->tid_, gctx.threads[cursor->tid_]);
+                bytes += size;
+                states.insert(std::move(state));
             }
+            else
+            {
+                full = true;
+            }
+            return false;
+        }
+
+        bool is_full() const { return full; }
+    };
 
-            // Try to find a thread to schedule next
-            size_t start_idx = cursor->children.empty() ? 0 : cursor->children.back()->tid_ + 1;
-            size_t no_threads = gctx.threads.size();
-            bool made_progress = false;
-            for (size_t i = start_idx; i < no_threads && !made_progress; ++i)
+    /**
+     * Run the first of the candidate threads that can make progress to its
+     * next sync point, and return its ID. Returns nothing if every candidate
+     * is blocked or terminated. Parked threads are known to be blocked and
+     * are not tried.
+     */
+    std::optional<ThreadID> schedule_first(GlobalContext &gctx, const std::vector<ThreadID> &candidates)
+    {
+        for (auto i : candidates)
+        {
+            auto thread = gctx.threads[i];
+            if (thread->terminated || thread->parked)
+                continue;
+
+            // Run the thread to the next sync point
+            verbose << "==== Thread " << i << " ====" << std::endl;
+            auto prog_or_term = progress_thread(gctx, i, thread);
+            if (auto term = std::get_if<TerminationStatus>(&prog_or_term))
             {
-                auto thread = gctx.threads[i];
-                if (!thread->terminated)
+                if (*term != TerminationStatus::completed)
+                    verbose << "Thread " << i << " terminated with an error" << std::endl;
+                return i;
+            }
+            else if (std::get<ProgressStatus>(prog_or_term) == ProgressStatus::progress)
+            {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * The cycle of the wait-for graph that a deadlocked trace ends in, if it
+     * ends in one. Replaying a trace does not try the threads that were
+     * blocked, so they are run until none of them can make progress.
+     */
+    std::optional<WaitCycle> deadlock_cycle(const bytecode::ProgramPtr &program, const std::vector<ThreadID> &trace)
+    {
+        auto gctx = replay_trace(program, trace, false);
+        while (!gctx.deadlock)
+        {
+            std::vector<ThreadID> candidates(gctx.runnable.begin(), gctx.runnable.end());
+            if (!schedule_first(gctx, candidates))
+                break;
+        }
+        return gctx.deadlock;
+    }
+
+    /**
+     * Decide whether a trace ends in the current state. A state in which no
+     * thread can make progress is only a deadlock if no thread ever could,
+     * i.e. if it is a leaf of the scheduling tree. A state with a cycle of
+     * waiting threads is a deadlock once no thread is runnable, without
+     * trying the blocked threads again. Threads outside the cycle may still
+     * fail, so while any of them can run the trace goes on, and the cycle
+     * is kept in the context for the report.
+     */
+    Outcome classify(const GlobalContext &gctx, bool made_progress, bool is_leaf)
+    {
+        bool all_completed = std::all_of(gctx.threads.begin(), gctx.threads.end(),
+                                         [](const auto &thread)
+                                         { return thread->terminated && *thread->terminated == TerminationStatus::completed; });
+        bool any_crashed =
+            std::any_of(gctx.threads.begin(), gctx.threads.end(),
+                        [](const auto &thread)
+                        { return thread->terminated && *thread->terminated != TerminationStatus::completed; });
+
+        if (any_crashed)
+            return Outcome::crashed;
+        if (gctx.deadlock && gctx.runnable.empty())
+            return Outcome::deadlocked;
+        if (all_completed)
+            return Outcome::completed;
+        if (!made_progress && is_leaf)
+            return Outcome::deadlocked;
+        return Outcome::running;
+    }
+
+    /**
+     * Explore the scheduling tree depth-first on the current thread.
+     */
+    void explore_serial(const bytecode::ProgramPtr &program, const ExploreOptions &options, ExplorationResult &result)
+    {
+        GlobalContext gctx(program, false);
+
+        // The stack of the depth-first search, from the root to the current
+        // node. Backtracking restores the snapshot of the nearest unexplored
+        // ancestor instead of replaying the trace from the root.
+        std::vector<Branch> path;
+        ContextPool pool;
+        if (options.resume)
+        {
+            path = load_checkpoint(program, options, gctx, result);
+        }
+        else
+        {
+            verbose << "==== Thread 0 ====" << std::endl;
+            progress_thread(gctx, 0, gctx.threads[0]);
+            path.push_back({TraceNode(0), pool.snapshot(gctx), 0, is_runnable(gctx, 0)});
+            if (options.partial_order_reduction)
+            {
+                record_enabled(gctx, path.back().node);
+            }
+        }
+
+        auto current_trace = std::vector<size_t>{}; // Starts with the main thread
+        for (const auto &branch : path)
+        {
+            current_trace.push_back(branch.node.tid_);
+        }
+
+        // Only one of several interchangeable threads is scheduled
+        std::optional<Symmetry> symmetry;
+        if (options.symmetry)
+        {
+            symmetry.emplace(program->ast);
+            if (!symmetry->is_enabled())
+                verbose << "Thread IDs are used outside of joins, not reducing symmetric schedules" << std::endl;
+        }
+
+        // A stateful search does not explore the subtree of a state that has
+        // been reached before
+        auto visited = VisitedStates(options.visited_limit_mb << 20);
+        if (options.stateful)
+        {
+            visited.visit(canonical_state(gctx));
+        }
+
+        // The path is saved whenever the interval has passed, at the top of
+        // the loop where the last node of the path is the current one
+        auto last_checkpoint = std::chrono::steady_clock::now();
+        const auto checkpoint_interval = std::chrono::seconds(options.checkpoint_interval);
+
+        while (!path.front().node.complete)
+        {
+            if (!options.checkpoint.empty() &&
+                std::chrono::steady_clock::now() - last_checkpoint >= checkpoint_interval)
+            {
+                save_checkpoint(program, options, path, result);
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
+
+            auto &branch = path.back();
+            auto &node = branch.node;
+
+            // Try to find a thread to schedule next. With partial-order
+            // reduction, only the first thread and the threads in the
+            // backtrack set are explored from a node.
+            auto candidates = std::vector<ThreadID>{};
+            if (options.partial_order_reduction && !node.is_leaf())
+            {
+                for (auto tid : node.backtrack)
                 {
-                    // Run the thread to the next sync point
-                    verbose << "==== Thread " << i << " ====" << std::endl;
-                    auto prog_or_term = progress_thread(gctx, i, thread);
-                    if (std::holds_alternative<TerminationStatus>(prog_or_term))
+                    if (!node.explored(tid))
+                        candidates.push_back(tid);
+                }
+            }
+            else
+            {
+                for (auto it = gctx.runnable.lower_bound(node.next_tid); it != gctx.runnable.end(); ++it)
+                    candidates.push_back(*it);
+            }
+
+            if (symmetry)
+            {
+                symmetry->reduce(gctx, candidates);
+            }
+
+            if (options.sleep_sets)
+            {
+                std::erase_if(candidates, [&node](ThreadID tid)
+                              { return node.asleep(tid); });
+            }
+
+            // Once the preemption bound is reached, only the thread that took
+            // the last step may continue while it is runnable
+            auto last = node.tid_;
+            auto unbounded = candidates;
+            bool preemptions_exhausted = options.max_preemptions &&
+                                         branch.preemptions >= *options.max_preemptions &&
+                                         branch.last_runnable;
+            bool cuts_runnable = false;
+            if (preemptions_exhausted)
+            {
+                cuts_runnable = std::any_of(candidates.begin(), candidates.end(),
+                                            [&gctx, last](ThreadID tid)
+                                            { return tid != last && is_runnable(gctx, tid); });
+                std::erase_if(candidates, [last](ThreadID tid)
+                              { return tid != last; });
+            }
+
+            auto scheduled = schedule_first(gctx, candidates);
+            if (!scheduled && preemptions_exhausted && node.is_leaf())
+            {
+                // The last thread turned out to be blocked, so switching to
+                // another thread is not a preemption
+                branch.last_runnable = false;
+                scheduled = schedule_first(gctx, unbounded);
+            }
+            else if (cuts_runnable)
+            {
+                result.bounded = true;
+            }
+
+            // A state in which only sleeping threads can make progress is
+            // not a deadlock, its traces are covered by a sibling subtree
+            bool only_asleep = false;
+            if (!scheduled && options.sleep_sets && node.is_leaf() && !node.sleep.empty())
+            {
+                std::vector<ThreadID> sleeping;
+                for (const auto &event : node.sleep)
+                    sleeping.push_back(event.tid);
+                auto probe = gctx.snapshot();
+                only_asleep = schedule_first(probe, sleeping).has_value();
+            }
+
+            size_t preemptions = branch.preemptions;
+            if (scheduled && *scheduled != last && branch.last_runnable)
+            {
+                preemptions++;
+            }
+
+            // The node reached by this step, if a thread could take one
+            std::optional<TraceNode> child;
+            if (scheduled)
+            {
+                // The thread made progress or terminated, we can extend the
+                // trace
+                node.extend(*scheduled);
+                child.emplace(*scheduled);
+                current_trace.push_back(*scheduled);
+                result.no_states++;
+
+                if (options.partial_order_reduction || options.sleep_sets)
+                {
+                    // The step started from the state the parent was reached
+                    // in, and the joined thread is known once the join has
+                    // been evaluated
+                    auto event = next_sync_event(branch.snapshot, *scheduled);
+                    if (event->kind == SyncKind::join && !event->joinee)
+                        event->joinee = join_target(branch.snapshot, gctx, *scheduled);
+                    child->event = event;
+                }
+
+                if (options.partial_order_reduction)
+                {
+                    child->clock = step_clock(path, *child->event);
+                    node.backtrack.insert(*scheduled);
+                }
+
+                if (options.sleep_sets)
+                {
+                    // Steps that are independent of this one stay asleep
+                    for (const auto *events : {&node.sleep, &node.done})
                     {
-                        // Thread terminated, we can extend the trace
-                        made_progress = true;
-                        cursor = cursor->extend(i);
-                        current_trace.push_back(i);
-                        if (std::get<TerminationStatus>(prog_or_term) != TerminationStatus::completed)
+                        for (const auto &event : *events)
                         {
-                            // Thread terminated with an error, we can stop here
-                            verbose << "Thread " << i << " terminated with an error" << std::endl;
-                            cursor->complete = true;
+                            if (!is_dependent(event, *child->event))
+                                child->sleep.push_back(event);
                         }
                     }
-                    else if (std::get<ProgressStatus>(prog_or_term) == ProgressStatus::progress)
-                    {
-                        // Thread made progress, we can continue
-                        made_progress = true;
-                        cursor = cursor->extend(i);
-                        current_trace.push_back(i);
-                    }
                 }
             }
-
-            if (!made_progress)
+            else
             {
                 // No threads made progress, we can stop here
-                cursor->complete = true;
+                node.complete = true;
             }
 
-            bool all_completed = std::all_of(gctx.threads.begin(), gctx.threads.end(),
-                                             [](const auto &thread)
-                                             { return thread->terminated && *thread->terminated == TerminationStatus::completed; });
-            bool any_crashed =
-                std::any_of(gctx.threads.begin(), gctx.threads.end(),
-                            [](const auto &thread)
-                            { return thread->terminated && *thread->terminated != TerminationStatus::completed; });
+            auto &cursor = child ? *child : node;
+            auto outcome = classify(gctx, scheduled.has_value(), cursor.is_leaf() && !only_asleep);
+
+            if (options.sleep_sets && scheduled && outcome != Outcome::crashed)
+            {
+                // An error ends the trace, so a step that crashes does not
+                // cover the traces in which other threads go first
+                node.done.push_back(*child->event);
+            }
 
-            bool is_deadlock = !all_completed && !made_progress && cursor->is_leaf();
+            if (options.partial_order_reduction && scheduled && outcome == Outcome::crashed)
+            {
+                // An error ends the trace, so it must not hide the steps of
+                // other threads from the state before it
+                node.backtrack.insert(node.enabled.begin(), node.enabled.end());
+            }
 
-            if (all_completed || any_crashed || is_deadlock)
+            if (outcome != Outcome::running)
             {
                 // Remember final state if it is new
-                if (!std::any_of(final_contexts.begin(), final_contexts.end(),
-                                 [&gctx](const GlobalContext &state)
-                                 { return state == gctx; }))
+                result.record(gctx, current_trace, outcome);
+                cursor.complete = true;
+
+                if (options.first_error && (outcome == Outcome::crashed || outcome == Outcome::deadlocked))
                 {
-                    final_contexts.push_back(gctx);
-                    final_traces.push_back(current_trace);
-                    if (any_crashed)
-                    {
-                        failing_traces.push_back(current_trace);
-                        failing_contexts.push_back(gctx);
-                    }
-                    else if (is_deadlock)
-                    {
-                        deadlocked_traces.push_back(current_trace);
-                        deadlocked_contexts.push_back(gctx);
-                    }
+                    verbose << "Stopping at the first error" << std::endl;
+                    break;
                 }
+            }
+
+            if (!cursor.complete && options.max_depth && current_trace.size() >= *options.max_depth)
+            {
+                verbose << "Reached the depth bound" << std::endl;
+                cursor.complete = true;
+                result.bounded = true;
+            }
 
-                cursor->complete = true;
+            if (!cursor.complete && options.stateful && visited.visit(bounded_state(gctx, options, current_trace, preemptions)))
+            {
+                verbose << "State has been explored before" << std::endl;
+                cursor.complete = true;
+                result.no_pruned++;
             }
 
-            if (cursor->complete && !root->complete)
+            if (!cursor.complete)
+            {
+                // Only a node that was just reached can be incomplete here
+                auto tid = child->tid_;
+                path.push_back({std::move(*child), pool.snapshot(gctx), preemptions, is_runnable(gctx, tid)});
+                if (options.partial_order_reduction)
+                {
+                    record_enabled(gctx, path.back().node);
+                    add_backtrack_points(gctx, path);
+                }
+            }
+            else if (!path.front().node.complete)
             {
-                // Reset the cursor to the root and start a new trace
+                // Backtrack to the nearest ancestor that may still have
+                // unexplored children, freeing the explored subtrees
+                while (path.back().node.complete)
+                {
+                    pool.release(std::move(path.back().snapshot));
+                    path.pop_back();
+                }
+
                 verbose << std::endl
-                        << "Restarting trace..." << std::endl;
-                gctx = GlobalContext(ast);
+                        << "Backtracking..." << std::endl;
+                current_trace.resize(path.size());
+                gctx.restore(path.back().snapshot);
+            }
+        }
+
+        result.visited_full = visited.is_full();
+    }
+
+    /**
+     * How each thread of a final state failed: the statement at which it
+     * crashed and with which error, or the statement at which it is stuck
+     * in a deadlock. Thread IDs are left out, so that traces that only
+     * differ in which of several identical threads failed are described the
+     * same way.
+     */
+    std::vector<std::string> describe_failure(const GlobalContext &gctx, Outcome outcome)
+    {
+        std::vector<std::string> failures;
+        for (const auto &thread : gctx.threads)
+        {
+            std::string kind;
+            if (!thread->terminated)
+            {
+                if (outcome != Outcome::deadlocked)
+                    continue;
+                kind = "stuck";
+            }
+            else
+            {
+                switch (*thread->terminated)
+                {
+                case TerminationStatus::completed:
+                    continue;
+                case TerminationStatus::datarace_exception:
+                    kind = "data race";
+                    break;
+                case TerminationStatus::unlock_exception:
+                    kind = "unlock of a lock it does not own";
+                    break;
+                case TerminationStatus::assertion_failure_exception:
+                    kind = "failed assertion";
+                    break;
+                case TerminationStatus::unassigned_variable_read_exception:
+                    kind = "read of an unassigned variable";
+                    break;
+                }
+            }
+
+            auto stmt = thread->block->at(thread->pc);
+            failures.push_back(kind + " at '" + std::string(stmt->location().view()) + "'");
+        }
+        return failures;
+    }
+
+    /**
+     * Print failing traces, each followed by how its final state failed,
+     * and write the execution graph of each of them.
+     */
+    void report_failures(const bytecode::ProgramPtr &program, const std::vector<std::vector<ThreadID>> &traces,
+                         const std::vector<uint64_t> &seeds, Outcome outcome,
+                         const std::filesystem::path &output_path, size_t &idx)
+    {
+        for (size_t i = 0; i < traces.size(); ++i)
+        {
+            const auto &trace = traces[i];
+            if (i < seeds.size())
+                std::cout << "(seed " << seeds[i] << ") ";
+            for (const auto &tid : trace)
+                std::cout << tid << " ";
+            std::cout << std::endl;
+
+            auto gctx = replay_trace(program, trace);
+            for (const auto &failure : describe_failure(gctx, outcome))
+                std::cout << "  " << failure << std::endl;
+            if (outcome == Outcome::deadlocked)
+            {
+                if (auto cycle = deadlock_cycle(program, trace))
+                    std::cout << "  in a cycle: " << describe_deadlock(*cycle) << std::endl;
+            }
+
+            gctx.print_execution_graph(build_output_path(output_path, idx++));
+        }
+    }
+
+    /**
+     * Find a shortest failing trace for each kind of failure by exploring
+     * with a depth bound that grows by one step at a time. All traces up to
+     * a depth are explored before any longer one, so the first trace found
+     * for a kind of failure is as short as possible. The search ends once a
+     * depth bound cuts nothing off.
+     */
+    void explore_shortest(const bytecode::ProgramPtr &program, const ExploreOptions &options, ExplorationResult &result)
+    {
+        std::set<std::string> kinds;
+        auto remember = [&](const std::vector<std::vector<ThreadID>> &traces, Outcome outcome,
+                            std::vector<std::vector<ThreadID>> &shortest)
+        {
+            auto sorted = traces;
+            std::stable_sort(sorted.begin(), sorted.end(),
+                             [](const auto &t1, const auto &t2)
+                             { return t1.size() < t2.size(); });
+            for (const auto &trace : sorted)
+            {
+                std::string kind = outcome == Outcome::crashed ? "crash" : "deadlock";
+                for (const auto &failure : describe_failure(replay_trace(program, trace, false), outcome))
+                    kind += "\n" + failure;
+                if (kinds.insert(kind).second)
+                    shortest.push_back(trace);
+            }
+        };
+
+        auto bounded_options = options;
+        result.no_states = 0;
+        for (size_t depth = 1;; ++depth)
+        {
+            verbose << "==== Exploring traces of at most " << depth << " step(s) ====" << std::endl;
+            bounded_options.max_depth = depth;
+
+            ExplorationResult iteration;
+            if (options.jobs > 1)
+            {
+                explore_parallel(program, bounded_options, iteration);
+            }
+            else
+            {
+                explore_serial(program, bounded_options, iteration);
+            }
 
-                cursor = root;
-                current_trace.clear();
-                current_trace.push_back(0); // Start with the main thread again
-                verbose << "==== Thread " << cursor->tid_ << " (replay) ====" << std::endl;
-                progress_thread(gctx, cursor->tid_, gctx.threads[cursor->tid_]);
+            result.no_states += iteration.no_states;
+            remember(iteration.failing_traces, Outcome::crashed, result.failing_traces);
+            remember(iteration.deadlocked_traces, Outcome::deadlocked, result.deadlocked_traces);
+
+            bool found_error = !result.failing_traces.empty() || !result.deadlocked_traces.empty();
+            if (!iteration.bounded || (options.first_error && found_error) ||
+                (options.max_depth && depth >= *options.max_depth))
+            {
+                result.bounded = iteration.bounded;
+                result.final_traces = std::move(iteration.final_traces);
+                break;
             }
         }
+    }
+
+    /**
+     * Explore all possible execution paths of the program, printing one trace
+     * for each distinct final state that led to an error.
+     */
+    int model_check(const Node ast, const std::filesystem::path &output_path, const ExploreOptions &options)
+    {
+        const auto start_time = std::chrono::steady_clock::now();
+        const auto program = bytecode::compile(ast);
+
+        ExplorationResult result;
+        if (options.samples)
+        {
+            sample_schedules(program, options, result);
+        }
+        else if (options.shortest)
+        {
+            explore_shortest(program, options, result);
+        }
+        else if (options.jobs > 1)
+        {
+            explore_parallel(program, options, result);
+        }
+        else
+        {
+            explore_serial(program, options, result);
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+        auto &final_traces = result.final_traces;
+        auto &failing_traces = result.failing_traces;
+        auto &deadlocked_traces = result.deadlocked_traces;
 
         verbose << "Found a total of " << final_traces.size() << " trace(s) with distinct final states:" << std::endl;
         print_traces(verbose, final_traces);
 
+        if (options.print_stats)
+        {
+            std::cout << "Explored " << result.no_states << " state(s) in " << elapsed.count() << "s ("
+                      << size_t(result.no_states / std::max(elapsed.count(), 1e-9)) << " states/s)" << std::endl;
+            if (options.stateful)
+            {
+                std::cout << "Pruned " << result.no_pruned << " revisited state(s)";
+                if (result.visited_full)
+                    std::cout << " (visited states exceeded " << options.visited_limit_mb << " MB)";
+                std::cout << std::endl;
+            }
+        }
+
+        if (options.max_preemptions || options.max_depth)
+        {
+            if (result.bounded)
+                std::cout << "Exploration was bounded, traces beyond the bounds were not explored" << std::endl;
+            else
+                std::cout << "Exploration was exhaustive, no trace reached the bounds" << std::endl;
+        }
+
+        if (options.samples)
+        {
+            std::cout << "Sampled " << result.no_samples << " random schedule(s) with seeds " << options.seed
+                      << " to " << options.seed + result.no_samples - 1 << std::endl;
+        }
+
         size_t idx = 0;
         if (!failing_traces.empty())
         {
             std::cout << "Found " << failing_traces.size() << " trace(s) with errors:" << std::endl;
-            print_traces(std::cout, failing_traces);
-
-            for (const auto &ctx : failing_contexts)
-            {
-                auto path = build_output_path(output_path, idx++);
-                ctx.print_execution_graph(path);
-            }
+            report_failures(program, failing_traces, result.failing_seeds, Outcome::crashed, output_path, idx);
         }
 
         if (!deadlocked_traces.empty())
         {
             std::cout << "Found " << deadlocked_traces.size() << " trace(s) leading to deadlock:" << std::endl;
-            print_traces(std::cout, deadlocked_traces);
-
-            for (const auto &ctx : deadlocked_contexts)
-            {
-                auto path = build_output_path(output_path, idx++);
-                ctx.print_execution_graph(path);
-            }
+            report_failures(program, deadlocked_traces, result.deadlocked_seeds, Outcome::deadlocked, output_path, idx);
         }
 
         return deadlocked_traces.empty() && failing_traces.empty() ? 0 : 1;
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <unordered_set>
+
+#include "interpreter.hh"
+
+namespace gitmem
+{
+    /* The ways in which an exploration can reach the end of a trace */
+    enum class Outcome
+    {
+        running,
+        completed,
+        crashed,
+        deadlocked,
+    };
+
+    /* The kind of synchronising statement that starts a step. Every thread
+     * that is not terminated is either blocked on, or about to execute, one
+     * of these, so the dependencies of a step are known before it is taken.
+     */
+    enum class SyncKind
+    {
+        lock,
+        unlock,
+        join,
+    };
+
+    /* A step of a thread as seen by partial-order reduction: the
+     * synchronising operation it starts with, and whether it may spawn a
+     * thread. The joined thread is unknown if the join expression has not
+     * been evaluated yet.
+     */
+    struct SyncEvent
+    {
+        ThreadID tid;
+        SyncKind kind;
+        std::string lock;
+        std::optional<ThreadID> joinee;
+        bool spawns = false;
+    };
+
+    /* A TraceNode is a level of the depth-first search through the space of
+     * possible schedulings. The path of TraceNodes from the root represents a
+     * scheduling, with the thread ID of each node being the thread that was
+     * scheduled at that point. A node only records which of its children
+     * have been explored, not the children themselves, so a subtree is freed
+     * as soon as the search backtracks out of it and memory grows with the
+     * depth of the tree instead of its size. When there are no more children
+     * to explore, or when one thread has crashed, the TraceNode is marked as
+     * complete so that the search backtracks past it.
+     *
+     * With partial-order reduction, a node also records the step that led to
+     * it and its happens-before clock, and the threads that are enabled and
+     * still need to be explored (the backtrack set) in its state.
+     *
+     * With sleep sets, a node records the steps that need not be taken from
+     * it because a sibling subtree already covers them (the sleep set), and
+     * the steps of its explored children that put later children to sleep.
+     */
+    struct TraceNode
+    {
+        size_t tid_;
+        bool complete = false;
+        ThreadID next_tid = 0; // The first thread that has not been tried in order of IDs
+        size_t no_children = 0;
+        std::vector<bool> explored_tids;
+
+        std::optional<SyncEvent> event;
+        VectorClock clock;
+        size_t no_threads = 0;
+        std::vector<ThreadID> enabled;
+        std::set<ThreadID> backtrack;
+
+        std::vector<SyncEvent> sleep;
+        std::vector<SyncEvent> done;
+
+        TraceNode(const size_t tid) : tid_(tid) {}
+
+        void extend(ThreadID tid)
+        {
+            if (explored_tids.size() <= tid)
+                explored_tids.resize(tid + 1, false);
+            explored_tids[tid] = true;
+            next_tid = tid + 1;
+            no_children++;
+        }
+
+        bool is_leaf() const
+        {
+            return no_children == 0;
+        }
+
+        bool explored(ThreadID tid) const
+        {
+            return tid < explored_tids.size() && explored_tids[tid];
+        }
+
+        bool asleep(ThreadID tid) const
+        {
+            return std::any_of(sleep.begin(), sleep.end(),
+                               [tid](const auto &event)
+                               { return event.tid == tid; });
+        }
+    };
+
+    /* Contexts that the model checker no longer needs, kept so that a
+     * snapshot can overwrite one of them instead of allocating the threads
+     * and tables of a new context. A depth-first search releases the
+     * snapshots of the branches it backtracks from, so it only allocates
+     * contexts until the pool holds as many as its deepest path.
+     */
+    class ContextPool
+    {
+        std::vector<GlobalContext> free;
+
+    public:
+        GlobalContext snapshot(const GlobalContext &gctx)
+        {
+            if (free.empty())
+                return gctx.snapshot();
+            auto copy = std::move(free.back());
+            free.pop_back();
+            copy.assign(gctx);
+            return copy;
+        }
+
+        void release(GlobalContext &&gctx) { free.push_back(std::move(gctx)); }
+    };
+
+    /* A level of the depth-first search, with a snapshot of the global
+     * context as it was when its node was first reached. The number of
+     * preemptions on the way to the node, and whether the thread that took
+     * the last step could take another one, bound the search.
+     */
+    struct Branch
+    {
+        TraceNode node;
+        GlobalContext snapshot;
+        size_t preemptions = 0;
+        bool last_runnable = false;
+    };
+
+    /* The traces found by exploring a program, one for each distinct final
+     * state, in the order in which the serial explorer finds them.
+     */
+    struct ExplorationResult
+    {
+        std::unordered_set<GlobalContext, GlobalContext::Hash> final_contexts;
+        std::vector<std::vector<ThreadID>> final_traces;
+        std::vector<std::vector<ThreadID>> failing_traces;
+        std::vector<std::vector<ThreadID>> deadlocked_traces;
+        size_t no_states = 1;
+        size_t no_pruned = 0; // States cut off by a stateful search
+        bool visited_full = false; // Whether the visited states hit the memory limit
+        bool bounded = false; // Whether a bound cut off part of the search
+        size_t no_samples = 0; // Random schedules run instead of exploring
+
+        // The seeds of the sampled schedules that the traces come from
+        std::vector<uint64_t> failing_seeds;
+        std::vector<uint64_t> deadlocked_seeds;
+
+        // Remember a trace if its final state has not been seen before
+        void record(const GlobalContext &gctx, const std::vector<ThreadID> &trace, Outcome outcome,
+                    std::optional<uint64_t> seed = std::nullopt)
+        {
+            if (final_contexts.contains(gctx))
+                return;
+
+            final_contexts.insert(gctx.snapshot());
+            final_traces.push_back(trace);
+            if (outcome == Outcome::crashed)
+            {
+                failing_traces.push_back(trace);
+                if (seed)
+                    failing_seeds.push_back(*seed);
+            }
+            else if (outcome == Outcome::deadlocked)
+            {
+                deadlocked_traces.push_back(trace);
+                if (seed)
+                    deadlocked_seeds.push_back(*seed);
+            }
+        }
+    };
+
+    /* A serialisation of the parts of a state that affect its future. Commit
+     * ids only matter up to equality, so they are renamed in order of first
+     * appearance, which lets interleavings that converge on the same state
+     * produce the same key.
+     */
+    struct StateKey
+    {
+        std::string bytes;
+        std::unordered_map<Commit, size_t> renaming;
+
+        void add(size_t value);
+        void add(const std::string &name);
+        void add(const Globals &globals);
+        void add_commit(Commit commit);
+    };
+
+    /* Threads that run structurally identical blocks and only refer to each
+     * other through the IDs returned by spawn are interchangeable: swapping
+     * two of them in a state gives a state with the same future up to the
+     * swap. Only one of several interchangeable threads needs to be
+     * scheduled from a state.
+     */
+    class Symmetry
+    {
+        std::map<std::string, size_t> classes;
+        NodeMap<size_t> block_class;
+        NodeMap<std::vector<std::set<std::string>>> live_registers;
+        std::set<std::string> tid_registers; // Only assigned by spawn
+        std::set<std::string> data_registers; // Assigned or read otherwise
+        std::set<std::string> joined_registers;
+        bool enabled = true;
+
+        void analyse(const Node &node);
+        size_t classify_block(const Node &block);
+        std::string key(const GlobalContext &gctx, ThreadID t1, ThreadID t2) const;
+        bool similar(const Thread &t1, const Thread &t2) const;
+
+    public:
+        Symmetry(const Node ast);
+
+        bool is_enabled() const { return enabled; }
+
+        // Drop the candidates that are interchangeable with a lower thread ID
+        void reduce(const GlobalContext &gctx, std::vector<ThreadID> &candidates) const;
+    };
+
+    void fingerprint(const Node &node, std::string &out);
+
+    GlobalContext replay_trace(const bytecode::ProgramPtr &program, const std::vector<ThreadID> &trace, bool record_graph = true);
+
+    void save_checkpoint(const bytecode::ProgramPtr &program, const ExploreOptions &options,
+                         const std::vector<Branch> &path, const ExplorationResult &result);
+
+    std::vector<Branch> load_checkpoint(const bytecode::ProgramPtr &program, const ExploreOptions &options,
+                                        GlobalContext &gctx, ExplorationResult &result);
+
+    std::optional<SyncEvent> next_sync_event(const GlobalContext &gctx, const ThreadID tid);
+
+    ThreadID join_target(const GlobalContext &before, const GlobalContext &after, const ThreadID tid);
+
+    bool is_dependent(const SyncEvent &e1, const SyncEvent &e2);
+
+    bool is_runnable(const GlobalContext &gctx, ThreadID tid);
+
+    std::optional<ThreadID> schedule_first(GlobalContext &gctx, const std::vector<ThreadID> &candidates);
+
+    Outcome classify(const GlobalContext &gctx, bool made_progress, bool is_leaf);
+
+    void explore_parallel(const bytecode::ProgramPtr &program, const ExploreOptions &options, ExplorationResult &result);
+
+    void sample_schedules(const bytecode::ProgramPtr &program, const ExploreOptions &options, ExplorationResult &result);
+}
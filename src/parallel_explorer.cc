@@ -0,0 +1,385 @@
+#include <atomic>
+#include <deque>
+#include <latch>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "model_checker.hh"
+
+namespace gitmem
+{
+    using namespace trieste;
+
+    /**
+     * An unexplored part of the scheduling tree: the node reached by a trace,
+     * the global context when the node was reached, and the first thread that
+     * has not been scheduled from that node yet. The number of preemptions on
+     * the trace, and whether its last thread could take another step, bound
+     * the search. With sleep sets, the steps that need not be taken from the
+     * node include those of the children that have been scheduled already.
+     */
+    struct Task
+    {
+        std::vector<ThreadID> trace;
+        GlobalContext snapshot;
+        ThreadID start_idx;
+        size_t preemptions;
+        bool last_runnable;
+        std::vector<SyncEvent> sleep;
+    };
+
+    /**
+     * The tasks owned by a worker. The owner pushes and pops at the back, so
+     * that it explores depth-first like the serial explorer, while idle
+     * workers steal from the front where the tasks closest to the root, and
+     * so the largest subtrees, are.
+     *
+     * The snapshot of a task shares storage with the contexts of the worker
+     * that pushed it, so a thief detaches it while holding the lock. The
+     * shared snapshot is handed back to the owner, which releases it when it
+     * next pops: storage is modified in place only by a worker that holds
+     * its last reference, and the owner only does so after it has taken the
+     * lock that the thief read the storage under.
+     */
+    class TaskDeque
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::vector<GlobalContext> stolen; // Shared snapshots of stolen tasks, for the owner to release
+
+    public:
+        void push(Task &&task)
+        {
+            std::lock_guard lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+
+        std::optional<Task> pop()
+        {
+            std::lock_guard lock(mutex);
+            stolen.clear();
+            if (tasks.empty())
+                return std::nullopt;
+            auto task = std::move(tasks.back());
+            tasks.pop_back();
+            return task;
+        }
+
+        std::optional<Task> steal()
+        {
+            std::lock_guard lock(mutex);
+            if (tasks.empty())
+                return std::nullopt;
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+            auto shared = std::exchange(task.snapshot, task.snapshot.detached());
+            stolen.push_back(std::move(shared));
+            return task;
+        }
+    };
+
+    /**
+     * A trace and how it ended, found by a worker
+     */
+    struct FinalTrace
+    {
+        std::vector<ThreadID> trace;
+        Outcome outcome;
+    };
+
+    using FinalTraces = std::unordered_map<GlobalContext, FinalTrace, GlobalContext::Hash>;
+
+    struct Worker
+    {
+        TaskDeque deque;
+        ContextPool pool;
+        FinalTraces finals;
+        size_t no_states = 0;
+        bool bounded = false;
+    };
+
+    /**
+     * Whether the serial explorer records a trace before another. Children
+     * are explored in order of thread ID, and a node that has children is
+     * only recorded after all of them.
+     */
+    bool precedes(const std::vector<ThreadID> &t1, const std::vector<ThreadID> &t2)
+    {
+        auto [it1, it2] = std::mismatch(t1.begin(), t1.end(), t2.begin(), t2.end());
+        if (it1 != t1.end() && it2 != t2.end())
+            return *it1 < *it2;
+        return it2 == t2.end() && it1 != t1.end();
+    }
+
+    /**
+     * The state shared by all workers: the number of tasks that have not been
+     * explored yet, and when stopping at the first error, the error found so
+     * far that the serial explorer would find first
+     */
+    struct SharedState
+    {
+        const ExploreOptions &options;
+        std::optional<Symmetry> symmetry;
+        std::atomic<size_t> pending = 1;
+
+        std::mutex error_mutex;
+        std::atomic<bool> found_error = false;
+        std::vector<ThreadID> first_error;
+
+        SharedState(const ExploreOptions &options) : options(options) {}
+
+        void record_error(const std::vector<ThreadID> &trace)
+        {
+            std::lock_guard lock(error_mutex);
+            if (!found_error || precedes(trace, first_error))
+                first_error = trace;
+            found_error = true;
+        }
+
+        /* Whether the serial explorer would have stopped before reaching any
+         * trace that starts with `trace` followed by a thread from `start_idx`
+         * on, so that the subtree need not be explored */
+        bool past_first_error(const std::vector<ThreadID> &trace, ThreadID start_idx)
+        {
+            if (!found_error)
+                return false;
+
+            auto prefix = trace;
+            prefix.push_back(start_idx);
+            std::lock_guard lock(error_mutex);
+            bool inside = first_error.size() >= prefix.size() &&
+                          std::equal(prefix.begin(), prefix.end(), first_error.begin());
+            return !inside && precedes(first_error, prefix);
+        }
+    };
+
+    /**
+     * Remember a final state, keeping the trace to it that the serial
+     * explorer would have found first
+     */
+    void remember(FinalTraces &finals, const GlobalContext &gctx, FinalTrace &&final)
+    {
+        auto it = finals.find(gctx);
+        if (it == finals.end())
+            finals.emplace(gctx.snapshot(), std::move(final));
+        else if (precedes(final.trace, it->second.trace))
+            it->second = std::move(final);
+    }
+
+    /**
+     * Explore a task depth-first. Whenever a thread is scheduled from a node,
+     * the remaining threads of that node are pushed as a new task.
+     */
+    void explore_task(Task &&task, Worker &self, SharedState &shared)
+    {
+        auto &options = shared.options;
+        auto &symmetry = shared.symmetry;
+        auto trace = std::move(task.trace);
+        auto arrival = std::move(task.snapshot);
+        auto start_idx = task.start_idx;
+        auto preemptions = task.preemptions;
+        auto last_runnable = task.last_runnable;
+        auto sleep = std::move(task.sleep);
+
+        GlobalContext gctx = self.pool.snapshot(arrival);
+
+        while (!shared.past_first_error(trace, start_idx))
+        {
+            auto candidates = std::vector<ThreadID>{};
+            for (auto it = gctx.runnable.lower_bound(start_idx); it != gctx.runnable.end(); ++it)
+                candidates.push_back(*it);
+            if (symmetry)
+                symmetry->reduce(gctx, candidates);
+            std::erase_if(candidates, [&sleep](ThreadID tid)
+                          { return std::any_of(sleep.begin(), sleep.end(),
+                                               [tid](const SyncEvent &event)
+                                               { return event.tid == tid; }); });
+
+            // Once the preemption bound is reached, only the thread that took
+            // the last step may continue while it is runnable
+            auto last = trace.back();
+            auto unbounded = candidates;
+            bool preemptions_exhausted = options.max_preemptions &&
+                                         preemptions >= *options.max_preemptions &&
+                                         last_runnable;
+            bool cuts_runnable = false;
+            if (preemptions_exhausted)
+            {
+                cuts_runnable = std::any_of(candidates.begin(), candidates.end(),
+                                            [&gctx, last](ThreadID tid)
+                                            { return tid != last && is_runnable(gctx, tid); });
+                std::erase_if(candidates, [last](ThreadID tid)
+                              { return tid != last; });
+            }
+
+            auto scheduled = schedule_first(gctx, candidates);
+            if (!scheduled && preemptions_exhausted && start_idx == 0)
+            {
+                // The last thread turned out to be blocked, so switching to
+                // another thread is not a preemption
+                last_runnable = false;
+                scheduled = schedule_first(gctx, unbounded);
+            }
+            else if (cuts_runnable)
+            {
+                self.bounded = true;
+            }
+
+            // A state in which only sleeping threads can make progress is
+            // not a deadlock, its traces are covered by a sibling subtree
+            bool only_asleep = false;
+            if (!scheduled && options.sleep_sets && start_idx == 0 && !sleep.empty())
+            {
+                std::vector<ThreadID> sleeping;
+                for (const auto &event : sleep)
+                    sleeping.push_back(event.tid);
+                auto probe = gctx.snapshot();
+                only_asleep = schedule_first(probe, sleeping).has_value();
+            }
+
+            auto outcome = classify(gctx, scheduled.has_value(), start_idx == 0 && !only_asleep);
+
+            if (scheduled)
+            {
+                std::optional<SyncEvent> event;
+                auto rest_sleep = sleep;
+                if (options.sleep_sets)
+                {
+                    event = next_sync_event(arrival, *scheduled);
+                    if (event->kind == SyncKind::join && !event->joinee)
+                        event->joinee = join_target(arrival, gctx, *scheduled);
+
+                    // An error ends the trace, so a step that crashes does
+                    // not cover the traces in which other threads go first
+                    if (outcome != Outcome::crashed)
+                        rest_sleep.push_back(*event);
+                    std::erase_if(sleep, [&event](const SyncEvent &asleep)
+                                  { return is_dependent(asleep, *event); });
+                }
+
+                shared.pending++;
+                self.deque.push({trace, self.pool.snapshot(arrival), *scheduled + 1, preemptions, last_runnable, std::move(rest_sleep)});
+                if (*scheduled != last && last_runnable)
+                    preemptions++;
+                trace.push_back(*scheduled);
+                self.no_states++;
+            }
+
+            if (outcome != Outcome::running)
+                remember(self.finals, gctx, {trace, outcome});
+
+            if (options.first_error && (outcome == Outcome::crashed || outcome == Outcome::deadlocked))
+                shared.record_error(trace);
+
+            if (!scheduled || outcome != Outcome::running)
+                break;
+
+            if (options.max_depth && trace.size() >= *options.max_depth)
+            {
+                self.bounded = true;
+                break;
+            }
+
+            arrival.assign(gctx);
+            start_idx = 0;
+            last_runnable = is_runnable(gctx, *scheduled);
+        }
+
+        // The contexts of a task that was stolen are this worker's now
+        self.pool.release(std::move(gctx));
+        self.pool.release(std::move(arrival));
+    }
+
+    /**
+     * Explore the scheduling tree with several worker threads. Each worker
+     * owns its global context and a deque of unexplored subtrees, and steals
+     * subtrees from other workers when it runs out. The final states found by
+     * all workers are merged in the order the serial explorer would have
+     * found them, so the result does not depend on the number of workers.
+     *
+     * When stopping at the first error, workers only skip the subtrees that
+     * the serial explorer would reach after the earliest error found so far,
+     * and go on exploring those before it. Every trace up to the error that
+     * the serial explorer stops at is therefore found, and the merge stops
+     * at the same error.
+     */
+    void explore_parallel(const bytecode::ProgramPtr &program, const ExploreOptions &options, ExplorationResult &result)
+    {
+        GlobalContext gctx(program, false);
+        verbose << "==== Thread 0 ====" << std::endl;
+        progress_thread(gctx, 0, gctx.threads[0]);
+
+        SharedState shared(options);
+        if (options.symmetry)
+            shared.symmetry.emplace(program->ast);
+
+        std::vector<Worker> workers(options.jobs);
+        workers[0].deque.push({{0}, gctx.snapshot(), 0, 0, is_runnable(gctx, 0), {}});
+
+        // The well-formedness definition used to navigate the AST is
+        // installed per thread, before any worker starts exploring
+        std::mutex wf_mutex;
+        std::latch ready(options.jobs);
+
+        auto work = [&](size_t id)
+        {
+            {
+                std::lock_guard lock(wf_mutex);
+                wf::push_back(gitmem::wf);
+            }
+            ready.arrive_and_wait();
+
+            auto &self = workers[id];
+            while (shared.pending > 0)
+            {
+                auto task = self.deque.pop();
+                for (size_t i = 1; !task && i < workers.size(); ++i)
+                    task = workers[(id + i) % workers.size()].deque.steal();
+
+                if (task)
+                {
+                    explore_task(std::move(*task), self, shared);
+                    shared.pending--;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            std::lock_guard lock(wf_mutex);
+            wf::pop_front();
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t id = 0; id < options.jobs; ++id)
+            threads.emplace_back(work, id);
+        for (auto &thread : threads)
+            thread.join();
+
+        // Merge the final states, keeping the first trace to each of them
+        FinalTraces finals;
+        for (auto &worker : workers)
+        {
+            result.no_states += worker.no_states;
+            result.bounded |= worker.bounded;
+            for (auto &[state, final] : worker.finals)
+                remember(finals, state, std::move(final));
+        }
+
+        std::vector<std::pair<const GlobalContext *, FinalTrace *>> ordered;
+        for (auto &[state, final] : finals)
+            ordered.emplace_back(&state, &final);
+        std::sort(ordered.begin(), ordered.end(),
+                  [](const auto &f1, const auto &f2)
+                  { return precedes(f1.second->trace, f2.second->trace); });
+
+        for (auto &[state, final] : ordered)
+        {
+            result.record(*state, final->trace, final->outcome);
+            if (options.first_error && (final->outcome == Outcome::crashed || final->outcome == Outcome::deadlocked))
+                break;
+        }
+    }
+}
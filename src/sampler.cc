@@ -0,0 +1,109 @@
+#include <random>
+
+#include "model_checker.hh"
+
+namespace gitmem
+{
+    using namespace trieste;
+
+    /**
+     * Run one schedule chosen by probabilistic concurrency testing (PCT).
+     * Every thread gets a random priority when it is spawned, and the thread
+     * with the highest priority that can make progress takes the next step.
+     * At `depth - 1` random steps, the thread that took the step drops to a
+     * priority below all initial priorities, which lets a bug that needs
+     * `depth` ordering constraints show up with a probability that does not
+     * depend on the number of schedules.
+     */
+    Outcome run_pct_schedule(GlobalContext &gctx, std::vector<ThreadID> &trace, std::mt19937_64 &rng,
+                             size_t depth, size_t length)
+    {
+        std::uniform_real_distribution<double> initial(depth, depth + 1);
+        std::vector<double> priorities = {initial(rng)};
+
+        // The steps at which priorities change, mapped to the new priority
+        std::unordered_map<size_t, double> change_points;
+        std::uniform_int_distribution<size_t> step(1, length);
+        for (size_t i = 1; i < depth && change_points.size() < length; ++i)
+        {
+            while (!change_points.try_emplace(step(rng), i).second)
+                ;
+        }
+
+        while (true)
+        {
+            while (priorities.size() < gctx.threads.size())
+                priorities.push_back(initial(rng));
+
+            auto candidates = std::vector<ThreadID>(gctx.runnable.begin(), gctx.runnable.end());
+            std::stable_sort(candidates.begin(), candidates.end(),
+                             [&priorities](ThreadID t1, ThreadID t2)
+                             { return priorities[t1] > priorities[t2]; });
+
+            auto scheduled = schedule_first(gctx, candidates);
+            if (scheduled)
+            {
+                trace.push_back(*scheduled);
+                if (auto it = change_points.find(trace.size() - 1); it != change_points.end())
+                    priorities[*scheduled] = it->second;
+            }
+
+            // Every thread was tried, so a state without progress is final
+            auto outcome = classify(gctx, scheduled.has_value(), true);
+            if (outcome != Outcome::running)
+                return outcome;
+        }
+    }
+
+    /**
+     * Run a number of random schedules, each from a seed of its own so that
+     * a failing schedule can be reproduced by sampling it alone. Only the
+     * current trace is kept in memory, and only traces that fail are
+     * recorded.
+     */
+    void sample_schedules(const bytecode::ProgramPtr &program, const ExploreOptions &options, ExplorationResult &result)
+    {
+        // The number of steps that priority changes are spread over is
+        // estimated by the schedule that always runs the lowest thread ID,
+        // which does not depend on the seed
+        GlobalContext first(program, false);
+        progress_thread(first, 0, first.threads[0]);
+        size_t length = 1;
+        while (true)
+        {
+            std::vector<ThreadID> candidates(first.runnable.begin(), first.runnable.end());
+            if (!schedule_first(first, candidates))
+                break;
+            length++;
+        }
+
+        // Every schedule starts after the first step of the main thread,
+        // and restarts by restoring that state into the same context
+        GlobalContext start(program, false);
+        progress_thread(start, 0, start.threads[0]);
+        GlobalContext gctx = start.snapshot();
+        std::vector<ThreadID> trace;
+
+        result.no_states = 0;
+        for (size_t i = 0; i < *options.samples; ++i)
+        {
+            uint64_t seed = options.seed + i;
+            verbose << "==== Sample with seed " << seed << " ====" << std::endl;
+
+            std::mt19937_64 rng(seed);
+            if (i > 0)
+                gctx.restore(start);
+            trace.assign(1, 0);
+
+            auto outcome = run_pct_schedule(gctx, trace, rng, options.pct_depth, length);
+            result.no_states += trace.size();
+            result.no_samples++;
+            if (outcome != Outcome::completed)
+            {
+                result.record(gctx, trace, outcome, seed);
+                if (options.first_error)
+                    break;
+            }
+        }
+    }
+}
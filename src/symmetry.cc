@@ -0,0 +1,261 @@
+#include "model_checker.hh"
+
+namespace gitmem
+{
+    using namespace trieste;
+
+    /**
+     * A textual fingerprint of a subtree, equal for structurally identical
+     * subtrees
+     */
+    void fingerprint(const Node &node, std::string &out)
+    {
+        out.append(node->type().str());
+        if (node->size() == 0)
+        {
+            out += '"';
+            out.append(node->location().view());
+            out += '"';
+            return;
+        }
+
+        out += '(';
+        for (const auto &child : *node)
+            fingerprint(child, out);
+        out += ')';
+    }
+
+    Symmetry::Symmetry(const Node ast)
+    {
+        auto block = ast / File / Block;
+        classify_block(block);
+        analyse(block);
+
+        // Thread IDs must only be stored in registers that are assigned by
+        // spawn and only read by join, otherwise a program could tell two
+        // threads apart by their IDs
+        for (const auto &reg : data_registers)
+        {
+            if (tid_registers.contains(reg))
+                enabled = false;
+        }
+        for (const auto &reg : joined_registers)
+        {
+            if (!tid_registers.contains(reg))
+                enabled = false;
+        }
+    }
+
+    /**
+     * The registers read by a statement, not counting the blocks of spawned
+     * threads
+     */
+    void registers_read(const Node &node, std::set<std::string> &regs)
+    {
+        if (node == Spawn)
+            return;
+        if (node == Reg)
+        {
+            regs.insert(std::string(node->location().view()));
+            return;
+        }
+
+        for (const auto &child : *node)
+        {
+            if (!(node == Assign && child == (node / LVal)))
+                registers_read(child, regs);
+        }
+    }
+
+    size_t Symmetry::classify_block(const Node &block)
+    {
+        std::string print;
+        fingerprint(block, print);
+        auto id = classes.try_emplace(std::move(print), classes.size()).first->second;
+        block_class[block] = id;
+
+        // Jumps only go forward, so a register that is not read at or after
+        // a statement is dead there
+        auto &live = live_registers[block];
+        live.resize(block->size() + 1);
+        for (size_t pc = block->size(); pc-- > 0;)
+        {
+            live[pc] = live[pc + 1];
+            registers_read(block->at(pc), live[pc]);
+        }
+        return id;
+    }
+
+    void Symmetry::analyse(const Node &node)
+    {
+        if (node == Assign)
+        {
+            auto lhs = node / LVal;
+            auto e = node / Expr / Expr;
+            if (lhs == Reg)
+            {
+                auto reg = std::string(lhs->location().view());
+                (e == Spawn ? tid_registers : data_registers).insert(reg);
+            }
+            else if (e == Spawn)
+            {
+                // A thread ID stored in a global can flow anywhere
+                enabled = false;
+            }
+
+            if (e == Spawn)
+            {
+                classify_block(e / Block);
+                analyse(e / Block);
+            }
+            else
+            {
+                analyse(node / Expr);
+            }
+            return;
+        }
+
+        if (node == Join)
+        {
+            auto e = node / Expr / Expr;
+            if (e == Reg)
+            {
+                joined_registers.insert(std::string(e->location().view()));
+            }
+            else if (e == Spawn)
+            {
+                classify_block(e / Block);
+                analyse(e / Block);
+            }
+            else
+            {
+                // Joining a computed thread ID
+                enabled = false;
+                analyse(node / Expr);
+            }
+            return;
+        }
+
+        if (node == Spawn)
+        {
+            // A spawn nested in another expression, whose ID may be compared
+            // or computed with
+            enabled = false;
+            classify_block(node / Block);
+        }
+        else if (node == Reg)
+        {
+            data_registers.insert(std::string(node->location().view()));
+        }
+
+        for (const auto &child : *node)
+            analyse(child);
+    }
+
+    /**
+     * Serialise a state with threads t1 and t2 swapped, renaming the thread
+     * IDs that are stored in registers, locks and cached join targets. Blocks
+     * are identified by their structure, dead registers are left out, and
+     * only the cached join target of a thread's current statement is
+     * included since statements are never executed twice.
+     */
+    std::string Symmetry::key(const GlobalContext &gctx, ThreadID t1, ThreadID t2) const
+    {
+        auto rename = [t1, t2](ThreadID tid)
+        { return tid == t1 ? t2 : tid == t2 ? t1 : tid; };
+
+        StateKey key;
+        key.add(gctx.threads.size());
+        for (ThreadID slot = 0; slot < gctx.threads.size(); ++slot)
+        {
+            auto &thread = gctx.threads[rename(slot)];
+            key.add(block_class.at(thread->block));
+            key.add(thread->pc);
+            key.add(thread->terminated ? size_t(*thread->terminated) + 1 : 0);
+
+            auto &live = live_registers.at(thread->block)[thread->terminated ? thread->block->size() : thread->pc];
+            std::vector<std::pair<std::string, size_t>> locals;
+            for (auto [slot, val] : thread->ctx.locals)
+            {
+                auto &reg = thread->code->regs[slot];
+                if (live.contains(reg))
+                    locals.emplace_back(reg, tid_registers.contains(reg) ? rename(val) : val);
+            }
+            std::sort(locals.begin(), locals.end());
+            key.add(locals.size());
+            for (const auto &[reg, val] : locals)
+            {
+                key.add(reg);
+                key.add(val);
+            }
+
+            size_t joinee = 0;
+            if (!thread->terminated)
+            {
+                auto s = thread->block->at(thread->pc) / Stmt;
+                if (s == Join)
+                {
+                    if (auto it = gctx.cache.find(s / Expr); it != gctx.cache.end())
+                        joinee = rename(it->second) + 1;
+                }
+            }
+            key.add(joinee);
+
+            key.add(thread->ctx.globals);
+        }
+
+        std::vector<const std::pair<const std::string, struct Lock> *> locks;
+        for (const auto &entry : gctx.locks)
+            locks.push_back(&entry);
+        std::sort(locks.begin(), locks.end(),
+                  [](auto *l1, auto *l2)
+                  { return l1->first < l2->first; });
+
+        key.add(locks.size());
+        for (const auto *entry : locks)
+        {
+            const auto &[name, lock] = *entry;
+            key.add(name);
+            key.add(lock.owner ? rename(*lock.owner) + 1 : 0);
+            key.add(lock.globals);
+        }
+
+        return std::move(key.bytes);
+    }
+
+    /**
+     * A cheap necessary condition for two threads to be interchangeable: they
+     * run structurally identical blocks, are at the same statement and see
+     * the same values of global variables
+     */
+    bool Symmetry::similar(const Thread &t1, const Thread &t2) const
+    {
+        if (block_class.at(t1.block) != block_class.at(t2.block) ||
+            t1.pc != t2.pc || t1.terminated != t2.terminated)
+            return false;
+
+        return t1.ctx.globals.same_values(t2.ctx.globals);
+    }
+
+    void Symmetry::reduce(const GlobalContext &gctx, std::vector<ThreadID> &candidates) const
+    {
+        if (!enabled)
+            return;
+
+        std::optional<std::string> unswapped;
+        std::erase_if(candidates,
+                      [this, &gctx, &unswapped](ThreadID tid)
+                      {
+                          for (ThreadID other = 0; other < tid; ++other)
+                          {
+                              if (!similar(*gctx.threads[other], *gctx.threads[tid]))
+                                  continue;
+                              if (!unswapped)
+                                  unswapped = key(gctx, 0, 0);
+                              if (*unswapped == key(gctx, other, tid))
+                                  return true;
+                          }
+                          return false;
+                      });
+    }
+}
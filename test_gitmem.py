@@ -2,12 +2,72 @@ import os
 import subprocess
 import sys
 import argparse
+import tempfile
 
 EXAMPLES_DIR = "examples"
+CHECKPOINT = os.path.join(tempfile.gettempdir(), "gitmem_test.checkpoint")
 
-def run_gitmem_test(gitmem_path, file_path, should_pass):
+# Every example is explored once per mode, in order, and all modes must agree
+EXPLORE_MODES = [
+    [],
+    ["--por"],
+    ["-j", "2"],
+    ["--stateful"],
+    ["--symmetry"],
+    ["--sleep-sets"],
+    ["--max-preemptions", "2"],
+    ["--sample", "100", "--seed", "1"],
+    ["--first-error"],
+    ["--shortest"],
+    # Save a checkpoint at every step, then resume from the last one
+    ["--checkpoint", CHECKPOINT, "--checkpoint-interval", "0"],
+    ["--checkpoint", CHECKPOINT, "--resume"],
+    ["--vector-clocks"],
+    ["--vector-clocks", "--por"],
+]
+
+# Pairs of modes that must not only agree on the exit code but report
+# exactly the same traces
+CROSS_VALIDATED_MODES = [
+    ([], ["--vector-clocks"]),
+    ([], ["-j", "2"]),
+    ([], ["-j", "4"]),
+    (["--first-error"], ["-j", "4", "--first-error"]),
+]
+
+# Pairs of modes that must find the same failures, although a reduced
+# exploration may report a different trace for each of them
+FAILURE_VALIDATED_MODES = [
+    ([], ["--por"]),
+    ([], ["--sleep-sets"]),
+    ([], ["--por", "--sleep-sets"]),
+    ([], ["--stateful"]),
+    ([], ["--symmetry"]),
+]
+
+# Whether the lockset analysis of --quick finds candidate races in an
+# example. Every example with a data race must be flagged: besides the
+# examples listed here, every example in QUICK_RACE_DIRS whose exploration
+# reports a data race is expected to be flagged.
+QUICK_RACE_DIRS = [
+    EXAMPLES_DIR,
+    os.path.join(EXAMPLES_DIR, "oracle"),
+    os.path.join(EXAMPLES_DIR, "failing", "semantics"),
+]
+QUICK_EXPECTED = {
+    os.path.join(EXAMPLES_DIR, "failing", "semantics", "conditional_race.gm"): True,
+    os.path.join(EXAMPLES_DIR, "failing", "semantics", "error_and_race.gm"): True,
+    os.path.join(EXAMPLES_DIR, "failing", "semantics", "identical_workers_race.gm"): True,
+    os.path.join(EXAMPLES_DIR, "failing", "semantics", "join_datarace.gm"): True,
+    os.path.join(EXAMPLES_DIR, "passing", "semantics", "conditional_non_race.gm"): False,
+    os.path.join(EXAMPLES_DIR, "passing", "semantics", "independent_locks.gm"): False,
+    os.path.join(EXAMPLES_DIR, "passing", "semantics", "join_fastforward.gm"): False,
+    os.path.join(EXAMPLES_DIR, "passing", "semantics", "lock_as_sync.gm"): False,
+}
+
+def run_gitmem_test(gitmem_path, file_path, should_pass, extra_args):
     try:
-        result = subprocess.run([gitmem_path, file_path, "-e", "-o", "/dev/null"], capture_output=True, text=True)
+        result = subprocess.run([gitmem_path, file_path, "-e", "-o", "/dev/null"] + extra_args, capture_output=True, text=True)
         passed = (result.returncode == 0)
     except FileNotFoundError:
         print(f"Error: '{gitmem_path}' executable not found.")
@@ -18,7 +78,65 @@ def run_gitmem_test(gitmem_path, file_path, should_pass):
     else:
         status = "FAIL"
 
-    print(f"[{status}] {file_path} (exit code: {result.returncode})")
+    mode = " ".join(extra_args)
+    print(f"[{status}] {file_path}{' ' + mode if mode else ''} (exit code: {result.returncode})")
+    return status == "PASS"
+
+def run_cross_validation(gitmem_path, file_path, args1, args2):
+    outputs = []
+    for extra_args in [args1, args2]:
+        result = subprocess.run([gitmem_path, file_path, "-e", "-o", "/dev/null"] + extra_args, capture_output=True, text=True)
+        outputs.append((result.returncode, result.stdout))
+
+    status = "PASS" if outputs[0] == outputs[1] else "FAIL"
+    print(f"[{status}] {file_path} '{' '.join(args1)}' agrees with '{' '.join(args2)}'")
+    return status == "PASS"
+
+def failure_set(output):
+    """The failures that gitmem reports, as the set of the descriptions of
+    the failing final states. A description lists how each thread failed,
+    without the thread IDs of a deadlock cycle."""
+    failures = set()
+    kind = None
+    trace = None
+    for line in output.splitlines() + [""]:
+        if line.startswith("  "):
+            if trace is not None and not line.startswith("  in a cycle:"):
+                trace.add(line.strip())
+            continue
+        if trace is not None:
+            failures.add((kind, frozenset(trace)))
+            trace = None
+        if line.startswith("Found ") and line.endswith("with errors:"):
+            kind = "crash"
+        elif line.startswith("Found ") and line.endswith("leading to deadlock:"):
+            kind = "deadlock"
+        elif kind is not None and line:
+            trace = set()
+    return failures
+
+def run_failure_validation(gitmem_path, file_path, args1, args2):
+    outputs = []
+    for extra_args in [args1, args2]:
+        result = subprocess.run([gitmem_path, file_path, "-e", "-o", "/dev/null"] + extra_args, capture_output=True, text=True)
+        outputs.append((result.returncode, failure_set(result.stdout)))
+
+    status = "PASS" if outputs[0] == outputs[1] else "FAIL"
+    print(f"[{status}] {file_path} '{' '.join(args1)}' finds the same failures as '{' '.join(args2)}'")
+    return status == "PASS"
+
+def has_data_race(gitmem_path, file_path):
+    """Whether exploring an example reports a data race"""
+    result = subprocess.run([gitmem_path, file_path, "-e", "-o", "/dev/null"], capture_output=True, text=True)
+    return any(failure.startswith("data race at")
+               for _, failures in failure_set(result.stdout) for failure in failures)
+
+def run_quick_test(gitmem_path, file_path, should_flag):
+    result = subprocess.run([gitmem_path, file_path, "--quick"], capture_output=True, text=True)
+    flagged = (result.returncode == 1)
+
+    status = "PASS" if flagged == should_flag else "FAIL"
+    print(f"[{status}] {file_path} --quick (exit code: {result.returncode})")
     return status == "PASS"
 
 def main():
@@ -43,9 +161,30 @@ def main():
             for root, _, files in os.walk(test_dir):
                 for file in files:
                     file_path = os.path.join(root, file)
-                    total_tests += 1
-                    if not run_gitmem_test(gitmem_path, file_path, should_pass):
-                        failed_tests += 1
+                    for extra_args in EXPLORE_MODES:
+                        total_tests += 1
+                        if not run_gitmem_test(gitmem_path, file_path, should_pass, extra_args):
+                            failed_tests += 1
+                    for args1, args2 in CROSS_VALIDATED_MODES:
+                        total_tests += 1
+                        if not run_cross_validation(gitmem_path, file_path, args1, args2):
+                            failed_tests += 1
+                    for args1, args2 in FAILURE_VALIDATED_MODES:
+                        total_tests += 1
+                        if not run_failure_validation(gitmem_path, file_path, args1, args2):
+                            failed_tests += 1
+
+    quick_expected = dict(QUICK_EXPECTED)
+    for race_dir in QUICK_RACE_DIRS:
+        for file in sorted(os.listdir(race_dir)):
+            file_path = os.path.join(race_dir, file)
+            if file.endswith(".gm") and has_data_race(gitmem_path, file_path):
+                quick_expected[file_path] = True
+
+    for file_path, should_flag in quick_expected.items():
+        total_tests += 1
+        if not run_quick_test(gitmem_path, file_path, should_flag):
+            failed_tests += 1
 
     print("\nSummary:")
     print(f"Total tests run: {total_tests}")